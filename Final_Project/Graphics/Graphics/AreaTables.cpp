@@ -0,0 +1,82 @@
+#include "AreaTables.h"
+#include <algorithm>
+
+using namespace std;
+
+AreaTables::AreaTables()
+	: masks(NULL), rows(0), cols(0), validRows(0)
+{
+}
+
+void AreaTables::attach(const TerrainMasks& masks)
+{
+	this->masks = &masks;
+	rows = masks.height();
+	cols = masks.width();
+	dry.assign((size_t)(rows + 1) * (cols + 1), 0);
+	wet.assign((size_t)(rows + 1) * (cols + 1), 0);
+	validRows = 1; // Table row 0 counts no rows and stays zero
+}
+
+void AreaTables::changed(int row, int count)
+{
+	if (count > 0 && row + count > 0)
+		validRows = min(validRows, max(row, 0) + 1);
+}
+
+bool AreaTables::allDry(int row, int col, int blockRows, int blockCols)
+{
+	if (row < 0 || col < 0 || row + blockRows > rows || col + blockCols > cols)
+		return false;
+	return dryCells(row, col, blockRows, blockCols) == blockRows * blockCols;
+}
+
+bool AreaTables::allWet(int row, int col, int blockRows, int blockCols)
+{
+	if (row < 0 || col < 0 || row + blockRows > rows || col + blockCols > cols)
+		return false;
+	return wetCells(row, col, blockRows, blockCols) == blockRows * blockCols;
+}
+
+int AreaTables::count(const vector<int>& table, int row, int col, int blockRows, int blockCols)
+{
+	int firstRow = max(row, 0);
+	int lastRow = min(row + blockRows, rows);
+	int firstCol = max(col, 0);
+	int lastCol = min(col + blockCols, cols);
+	if (firstRow >= lastRow || firstCol >= lastCol)
+		return 0;
+	refresh(lastRow);
+
+	size_t stride = cols + 1;
+	return table[lastRow * stride + lastCol] - table[firstRow * stride + lastCol] -
+		table[lastRow * stride + firstCol] + table[firstRow * stride + firstCol];
+}
+
+void AreaTables::refresh(int lastRow)
+{
+	size_t stride = cols + 1;
+	for (; validRows <= lastRow; validRows++)
+	{
+		// Table row i adds the running count of grid row i - 1 to table row i - 1
+		int i = validRows;
+		const int* dryAbove = &dry[(i - 1) * stride];
+		const int* wetAbove = &wet[(i - 1) * stride];
+		int* dryRow = &dry[i * stride];
+		int* wetRow = &wet[i * stride];
+		int dryCount = 0, wetCount = 0;
+		for (int first = 0; first < cols; first += 64)
+		{
+			uint64_t dryBits = masks->bits(MASK_DRY, i - 1, first);
+			uint64_t wetBits = masks->bits(MASK_RIVER, i - 1, first) | masks->bits(MASK_SEA, i - 1, first);
+			int last = min(first + 64, cols);
+			for (int j = first; j < last; j++)
+			{
+				dryCount += (int)((dryBits >> (j - first)) & 1);
+				wetCount += (int)((wetBits >> (j - first)) & 1);
+				dryRow[j + 1] = dryAbove[j + 1] + dryCount;
+				wetRow[j + 1] = wetAbove[j + 1] + wetCount;
+			}
+		}
+	}
+}
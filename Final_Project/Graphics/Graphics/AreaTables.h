@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include "TerrainMasks.h"
+
+// Summed-area tables of the dry cells and of the wet cells (river or sea) of a TerrainMasks: entry (i, j) counts the
+// cells of a class in rows 0 to i - 1 and columns 0 to j - 1, so the cells of a class in any rectangle take four
+// lookups whatever its size, and a building or road of any footprint is checked at the same cost.
+// Row i of a table only depends on rows 0 to i of the masks. After a change the tables are valid down to the first
+// changed row, and a query brings them up to date only as far down as the rows it reads: an edit followed by a query
+// near it, like a city walker flattening a cell and testing the next block, recomputes a few rows.
+// The tables only read the masks, which have to outlive them.
+class AreaTables {
+public:
+	AreaTables();
+
+	// Answer queries for masks from now on, as they are now
+	void attach(const TerrainMasks& masks);
+
+	// The classes of rows row to row + count - 1 of the masks changed
+	void changed(int row, int count);
+
+	// Bring every row of the tables up to date. Until the next change, queries then only read the tables and can be
+	// made from several threads at once.
+	void refresh() { refresh(rows); }
+
+	// Cells of the class in the blockRows x blockCols block at (row, col), cells outside the grid count as neither
+	int dryCells(int row, int col, int blockRows, int blockCols) { return count(dry, row, col, blockRows, blockCols); }
+	int wetCells(int row, int col, int blockRows, int blockCols) { return count(wet, row, col, blockRows, blockCols); }
+
+	// True when every cell of the block has the class, false when the block leaves the grid
+	bool allDry(int row, int col, int blockRows, int blockCols);
+	bool allWet(int row, int col, int blockRows, int blockCols);
+
+private:
+	int count(const std::vector<int>& table, int row, int col, int blockRows, int blockCols);
+
+	// Recompute the entries of the tables up to row lastRow (a table row, one past the grid row)
+	void refresh(int lastRow);
+
+	const TerrainMasks* masks;
+	int rows, cols;
+	int validRows; // Table rows 0 to validRows - 1 match the masks
+	std::vector<int> dry, wet; // (rows + 1) x (cols + 1) entries
+};
@@ -0,0 +1,196 @@
+#include "CitySites.h"
+#include "Parallel.h"
+#include <mutex>
+#include <algorithm>
+#include <queue>
+
+using namespace std;
+
+// A cell of a template, relative to the site, and the class it must have
+typedef struct {
+	int row, col;
+	MaskPlane plane;
+} TemplateCell;
+
+// A site matches when every cell of base and every cell of one of the branches has its class
+typedef struct {
+	CityDirection direction;
+	TemplateCell base[8];
+	TemplateCell branches[2][4]; // The river runs on to the sea to one side or the other
+} SiteTemplate;
+
+const SiteTemplate SITE_TEMPLATES[4] = {
+	{ CITY_RIGHT,
+		{ { 0, 0, MASK_DRY }, { 0, -1, MASK_DRY }, { 0, 1, MASK_DRY }, { -1, 0, MASK_DRY }, { -1, -1, MASK_DRY }, { -1, 1, MASK_DRY }, { 2, 0, MASK_RIVER }, { 3, 0, MASK_RIVER } },
+		{ { { 2, 1, MASK_RIVER }, { 2, 2, MASK_RIVER }, { 2, 3, MASK_RIVER }, { 2, 4, MASK_SEA } },
+		{ { 2, -1, MASK_RIVER }, { 2, -2, MASK_RIVER }, { 2, -3, MASK_RIVER }, { 2, -4, MASK_SEA } } } },
+	{ CITY_LEFT,
+		{ { 0, 0, MASK_DRY }, { 0, -1, MASK_DRY }, { 0, 1, MASK_DRY }, { 1, 0, MASK_DRY }, { 1, -1, MASK_DRY }, { 1, 1, MASK_DRY }, { -2, 0, MASK_RIVER }, { -3, 0, MASK_RIVER } },
+		{ { { -2, 1, MASK_RIVER }, { -2, 2, MASK_RIVER }, { -2, 3, MASK_RIVER }, { -2, 4, MASK_SEA } },
+		{ { -2, -1, MASK_RIVER }, { -2, -2, MASK_RIVER }, { -2, -3, MASK_RIVER }, { -2, -4, MASK_SEA } } } },
+	{ CITY_UP,
+		{ { 0, 0, MASK_DRY }, { -1, 0, MASK_DRY }, { 1, 0, MASK_DRY }, { 0, -1, MASK_DRY }, { -1, -1, MASK_DRY }, { 1, -1, MASK_DRY }, { 0, 2, MASK_RIVER }, { 0, 3, MASK_RIVER } },
+		{ { { 1, 2, MASK_RIVER }, { 2, 2, MASK_RIVER }, { 3, 2, MASK_RIVER }, { 4, 2, MASK_SEA } },
+		{ { -1, 2, MASK_RIVER }, { -2, 2, MASK_RIVER }, { -3, 2, MASK_RIVER }, { -4, 2, MASK_SEA } } } },
+	{ CITY_DOWN,
+		{ { 0, 0, MASK_DRY }, { -1, 0, MASK_DRY }, { 1, 0, MASK_DRY }, { 0, 1, MASK_DRY }, { -1, 1, MASK_DRY }, { 1, 1, MASK_DRY }, { 0, -2, MASK_RIVER }, { 0, -3, MASK_RIVER } },
+		{ { { 1, -2, MASK_RIVER }, { 2, -2, MASK_RIVER }, { 3, -2, MASK_RIVER }, { 4, -2, MASK_SEA } },
+		{ { -1, -2, MASK_RIVER }, { -2, -2, MASK_RIVER }, { -3, -2, MASK_RIVER }, { -4, -2, MASK_SEA } } } }
+};
+
+// Bit k is set when the template cells of the site at (row, col + k) all have their class
+static uint64_t matchCells(const TerrainMasks& masks, int row, int col, const TemplateCell* cells, int count)
+{
+	uint64_t match = ~(uint64_t)0;
+	for (int k = 0; k < count; k++)
+		match &= masks.bits(cells[k].plane, row + cells[k].row, col + cells[k].col);
+	return match;
+}
+
+vector<CitySite> scanCitySites(const TerrainMasks& masks, int numThreads)
+{
+	vector<CitySite> sites;
+	mutex sitesLock;
+	parallelRange(0, masks.height(), numThreads, [&](int firstRow, int lastRow)
+	{
+		vector<CitySite> found;
+		for (int i = firstRow; i < lastRow; i++)
+		{
+			for (int w = 0; w < masks.words(); w++)
+			{
+				// Every template starts with a dry site cell, so the bits past the last column never match
+				int col = w * 64;
+				uint64_t matches[4];
+				uint64_t any = 0;
+				for (int d = 0; d < 4; d++)
+				{
+					const SiteTemplate& site = SITE_TEMPLATES[d];
+					matches[d] = matchCells(masks, i, col, site.base, 8) &
+						(matchCells(masks, i, col, site.branches[0], 4) | matchCells(masks, i, col, site.branches[1], 4));
+					any |= matches[d];
+				}
+
+				for (int k = 0; k < 64 && any >> k != 0; k++)
+				{
+					for (int d = 0; d < 4; d++)
+					{
+						if ((matches[d] >> k) & 1)
+						{
+							CitySite site = { i, col + k, SITE_TEMPLATES[d].direction };
+							found.push_back(site);
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		lock_guard<mutex> guard(sitesLock);
+		sites.insert(sites.end(), found.begin(), found.end());
+	});
+
+	// Bands finish in any order
+	sort(sites.begin(), sites.end(), [](const CitySite& a, const CitySite& b) { return a.x != b.x ? a.x < b.x : a.z < b.z; });
+	return sites;
+}
+
+// Strict order of the ranking: higher score first, then lower row, then lower column
+static bool betterSite(const RankedSite& a, const RankedSite& b)
+{
+	if (a.score != b.score)
+		return a.score > b.score;
+	return a.site.x != b.site.x ? a.site.x < b.site.x : a.site.z < b.site.z;
+}
+
+// Unbroken river cells from (row, col) on, stepping by (rowStep, colStep), at most RIVER_REACH
+static int riverRun(const TerrainMasks& masks, int row, int col, int rowStep, int colStep)
+{
+	int length = 0;
+	for (int i = row, j = col; length < RIVER_REACH; i += rowStep, j += colStep)
+	{
+		if (i < 0 || i >= masks.height() || j < 0 || j >= masks.width() || !masks.river(i, j))
+			break;
+		length++;
+	}
+	return length;
+}
+
+// Chessboard distance from (row, col) to the nearest sea cell, one row of the square per bitboard read
+static int seaDistance(const TerrainMasks& masks, int row, int col)
+{
+	for (int d = 1; d <= SEA_REACH; d++)
+	{
+		uint64_t square = ((uint64_t)1 << (2 * d + 1)) - 1;
+		int firstRow = max(row - d, 0);
+		int lastRow = min(row + d, masks.height() - 1);
+		for (int i = firstRow; i <= lastRow; i++)
+		{
+			if (masks.bits(MASK_SEA, i, col - d) & square)
+				return d;
+		}
+	}
+	return SEA_REACH + 1;
+}
+
+static RankedSite scoreSite(const TerrainMasks& masks, AreaTables& areas, const CitySite& site)
+{
+	RankedSite ranked;
+	ranked.site = site;
+	int x = site.x, z = site.z;
+
+	// The strip the walkers build along and the row or column of the river the site faces
+	switch (site.direction)
+	{
+	case CITY_RIGHT:
+		ranked.dryArea = areas.dryCells(x - CITY_REACH + 1, z - 2, CITY_REACH, 5);
+		ranked.riverLength = riverRun(masks, x + 2, z, 0, 1) + riverRun(masks, x + 2, z - 1, 0, -1);
+		break;
+	case CITY_LEFT:
+		ranked.dryArea = areas.dryCells(x, z - 2, CITY_REACH, 5);
+		ranked.riverLength = riverRun(masks, x - 2, z, 0, 1) + riverRun(masks, x - 2, z - 1, 0, -1);
+		break;
+	case CITY_UP:
+		ranked.dryArea = areas.dryCells(x - 2, z - CITY_REACH + 1, 5, CITY_REACH);
+		ranked.riverLength = riverRun(masks, x, z + 2, 1, 0) + riverRun(masks, x - 1, z + 2, -1, 0);
+		break;
+	default:
+		ranked.dryArea = areas.dryCells(x - 2, z, 5, CITY_REACH);
+		ranked.riverLength = riverRun(masks, x, z - 2, 1, 0) + riverRun(masks, x - 1, z - 2, -1, 0);
+		break;
+	}
+	ranked.seaDistance = seaDistance(masks, x, z);
+	ranked.score = ranked.dryArea + RIVER_WEIGHT * ranked.riverLength - SEA_WEIGHT * ranked.seaDistance;
+	return ranked;
+}
+
+vector<RankedSite> rankCitySites(const TerrainMasks& masks, AreaTables& areas, int count, int numThreads)
+{
+	vector<CitySite> sites = scanCitySites(masks, numThreads);
+	vector<RankedSite> best;
+	if (count <= 0 || sites.empty())
+		return best;
+	areas.refresh(); // The threads below only read the tables
+
+	// The top of a heap is the worst of the best count sites a thread has seen
+	typedef priority_queue<RankedSite, vector<RankedSite>, bool(*)(const RankedSite&, const RankedSite&)> SiteHeap;
+	mutex bestLock;
+	parallelRange(0, (int)sites.size(), numThreads, [&](int first, int last)
+	{
+		SiteHeap heap(betterSite);
+		for (int i = first; i < last; i++)
+		{
+			heap.push(scoreSite(masks, areas, sites[i]));
+			if ((int)heap.size() > count)
+				heap.pop();
+		}
+
+		lock_guard<mutex> guard(bestLock);
+		for (; !heap.empty(); heap.pop())
+			best.push_back(heap.top());
+	});
+
+	sort(best.begin(), best.end(), betterSite);
+	if ((int)best.size() > count)
+		best.resize(count);
+	return best;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include "TerrainMasks.h"
+#include "AreaTables.h"
+
+// Direction a city grows in from its site, away from the river it is founded on, the cityExpand* flags of World.h
+// as one value. The values are stored in world files.
+enum CityDirection {
+	CITY_NONE = 0,
+	CITY_RIGHT = 1, // The river runs two rows below the site
+	CITY_LEFT = 2, // The river runs two rows above the site
+	CITY_UP = 3, // The river runs two columns right of the site
+	CITY_DOWN = 4 // The river runs two columns left of the site
+};
+
+// A place to found a city: a 3x2 block of dry land next to a river that reaches the sea within four cells.
+// x is the row and z the column of the cell the city starts from, like cityLocation.
+typedef struct {
+	int x;
+	int z;
+	CityDirection direction;
+} CitySite;
+
+// Every city site of the grid in row-major order, with the direction of the first template that matches in the
+// order right, left, up, down. Templates are matched on the class bitboards of the grid, 64 neighbouring sites per
+// AND of shifted words, over bands of rows in parallel.
+std::vector<CitySite> scanCitySites(const TerrainMasks& masks, int numThreads);
+
+const int CITY_REACH = 64; // Length of the strip of land a city grows along from its site
+const int RIVER_REACH = 32; // Cells of river counted on each side of a site
+const int SEA_REACH = 16; // Farthest sea cell looked for around a site
+
+// Weights of the score of a site: the dry cells of its strip, plus the river cells it borders, minus the distance to
+// the sea, so a city with room to grow on a long river near the sea ranks first
+const int RIVER_WEIGHT = 2;
+const int SEA_WEIGHT = 8;
+
+// A city site and the measures it is scored by
+typedef struct {
+	CitySite site;
+	int dryArea; // Dry cells of the 5 x CITY_REACH strip the city walkers build along
+	int riverLength; // Unbroken river cells along the river the site faces, up to RIVER_REACH each way
+	int seaDistance; // Chessboard distance to the nearest sea cell, SEA_REACH + 1 when there is none that close
+	int score;
+} RankedSite;
+
+// The count best scored city sites of the grid, best first. Sites are scored in parallel and every thread keeps its
+// best count in a bounded heap, equal scores are ordered by row then column so the ranking does not depend on the
+// threads. areas must be attached to masks.
+std::vector<RankedSite> rankCitySites(const TerrainMasks& masks, AreaTables& areas, int count, int numThreads);
@@ -0,0 +1,231 @@
+#include "DropletErosion.h"
+#include "Random.h"
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+
+using namespace std;
+
+// Follow one droplet along flow directions that do not change while it runs and count every cell it erodes.
+// Each step goes strictly downhill, so the droplet cannot come back to a cell and always stops in a local minimum.
+// Cells counted for the first time in the round are added to reached.
+template <typename T>
+static int traceDroplet(const FlowDirections<T>& directions, int row, int col, atomic<int>* visits, vector<ReachedCell>& reached)
+{
+	int cell = row * directions.width() + col;
+	int steps = 0;
+	while (true)
+	{
+		if (visits[cell].fetch_add(1, memory_order_relaxed) == 0)
+		{
+			ReachedCell first = { cell, row };
+			reached.push_back(first);
+		}
+		steps++;
+
+		uint8_t code = directions.code(cell);
+		if (code == FLOW_NONE)
+			return steps;
+		cell += directions.offset(code);
+		row += FLOW_ROW_OFFSETS[code];
+	}
+}
+
+template <typename T>
+DropletErosion<T>::DropletErosion()
+	: roundOpen(false)
+{
+}
+
+template <typename T>
+void DropletErosion<T>::reset()
+{
+	flow = FlowDirections<T>();
+	reached.clear();
+	roundOpen = false;
+}
+
+template <typename T>
+ErosionStats DropletErosion<T>::run(Heightfield<T>& terrain, const DropletBatch& batch, int numThreads)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ErosionStats stats = { 0, 0, 0 };
+	int height = terrain.height();
+	int width = terrain.width();
+	for (size_t k = 0; k < lowered.size(); k++)
+		inLowered[lowered[k]] = 0;
+	lowered.clear();
+	if (batch.numDroplets <= 0 || terrain.empty())
+		return stats;
+	uint64_t roundSize = max(batch.roundSize, 1);
+	if (!flow.matches(terrain))
+	{
+		// Counts are all zero between rounds, so they only have to be cleared when the grid changes
+		flow.build(terrain, numThreads);
+		vector<atomic<int> >((size_t)height * width).swap(visits);
+		for (size_t i = 0; i < visits.size(); i++)
+			visits[i].store(0, memory_order_relaxed);
+		rowStart.assign(height + 1, 0);
+		rowFill.assign(height, 0);
+		inLowered.assign((size_t)height * width, 0);
+		reached.clear();
+		roundOpen = false;
+	}
+
+	// A round left open by the last batch is only continued by the droplets that follow it in the same stream
+	if (roundOpen && (batch.seed != open.seed || batch.firstDroplet != open.firstDroplet + open.numDroplets || batch.roundSize != open.roundSize))
+		applyRound(terrain, numThreads);
+
+	uint64_t first = batch.firstDroplet;
+	uint64_t end = batch.firstDroplet + batch.numDroplets;
+	while (first < end)
+	{
+		uint64_t roundEnd = (first / roundSize + 1) * roundSize;
+		uint64_t last = min(roundEnd, end);
+		if (!roundOpen)
+		{
+			open = batch;
+			open.firstDroplet = first;
+			open.numDroplets = 0;
+			roundOpen = true;
+		}
+		stats.steps += traceDroplets(terrain, first, (int)(last - first), numThreads);
+		open.numDroplets += (int)(last - first);
+		if (last == roundEnd)
+			applyRound(terrain, numThreads);
+		first = last;
+	}
+
+	stats.droplets = batch.numDroplets;
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+template <typename T>
+void DropletErosion<T>::finishRound(Heightfield<T>& terrain, int numThreads)
+{
+	for (size_t k = 0; k < lowered.size(); k++)
+		inLowered[lowered[k]] = 0;
+	lowered.clear();
+	if (roundOpen && flow.matches(terrain))
+		applyRound(terrain, numThreads);
+}
+
+// Trace count droplets from firstDroplet on over the unchanged directions, every thread a contiguous range of them
+template <typename T>
+long long DropletErosion<T>::traceDroplets(const Heightfield<T>& terrain, uint64_t firstDroplet, int count, int numThreads)
+{
+	int height = terrain.height();
+	int width = terrain.width();
+	atomic<long long> steps(0);
+	mutex reachedLock;
+	parallelRange(0, count, numThreads, [&](int firstIndex, int lastIndex)
+	{
+		vector<ReachedCell> cells;
+		long long threadSteps = 0;
+		for (int k = firstIndex; k < lastIndex; k++)
+		{
+			RandomStream random(open.seed, STAGE_EROSION, firstDroplet + k);
+			int row = random.nextInt(height);
+			int col = random.nextInt(width);
+			threadSteps += traceDroplet(flow, row, col, &visits[0], cells);
+		}
+		steps.fetch_add(threadSteps, memory_order_relaxed);
+
+		lock_guard<mutex> guard(reachedLock);
+		reached.push_back(vector<ReachedCell>());
+		reached.back().swap(cells);
+	});
+	return steps.load();
+}
+
+// Lower the cells reached by the open round and bring the directions around them up to date
+template <typename T>
+void DropletErosion<T>::applyRound(Heightfield<T>& terrain, int numThreads)
+{
+	int height = terrain.height();
+	int width = terrain.width();
+	double amount = open.amount;
+
+	// Counting sort of the reached cells by row, so the passes below walk the grid in memory order
+	// and every thread finds the cells of its band of rows directly
+	fill(rowStart.begin(), rowStart.end(), 0);
+	for (size_t l = 0; l < reached.size(); l++)
+		for (size_t k = 0; k < reached[l].size(); k++)
+			rowStart[reached[l][k].row + 1]++;
+	for (int i = 0; i < height; i++)
+	{
+		rowStart[i + 1] += rowStart[i];
+		rowFill[i] = rowStart[i];
+	}
+	sorted.resize(rowStart[height]);
+	for (size_t l = 0; l < reached.size(); l++)
+	{
+		for (size_t k = 0; k < reached[l].size(); k++)
+		{
+			int cell = reached[l][k].cell;
+			sorted[rowFill[reached[l][k].row]++] = cell;
+			if (!inLowered[cell])
+			{
+				inLowered[cell] = 1;
+				lowered.push_back(cell);
+			}
+		}
+	}
+
+	// Lower every reached cell once for all droplets of the round
+	parallelRange(0, height, numThreads, [&](int firstRow, int lastRow)
+	{
+		for (int i = firstRow; i < lastRow; i++)
+		{
+			T* row = terrain.row(i);
+			for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+			{
+				int cell = sorted[k];
+				int col = cell - i * width;
+				row[col] = (T)(row[col] - amount * visits[cell].load(memory_order_relaxed));
+			}
+		}
+	});
+
+	// Recompute the directions of the lowered cells and offer every lowered cell to its neighbours that were not
+	// lowered themselves, then clear the counts for the next round. Every thread owns a band of rows and only
+	// writes the cells in it (codes and counts), so no cell is written by two threads.
+	parallelRange(0, height, numThreads, [&](int firstRow, int lastRow)
+	{
+		for (int i = max(firstRow - 1, 0); i < min(lastRow + 1, height); i++)
+		{
+			bool inBand = i >= firstRow && i < lastRow;
+			bool aboveInBand = i - 1 >= firstRow && i - 1 < lastRow;
+			bool belowInBand = i + 1 >= firstRow && i + 1 < lastRow;
+			for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+			{
+				int cell = sorted[k];
+				int col = cell - i * width;
+				if (inBand)
+				{
+					flow.refresh(terrain, i, col);
+					if (col > 0 && visits[cell - 1].load(memory_order_relaxed) == 0)
+						flow.neighbourLowered(terrain, i, col - 1, FLOW_RIGHT);
+					if (col < width - 1 && visits[cell + 1].load(memory_order_relaxed) == 0)
+						flow.neighbourLowered(terrain, i, col + 1, FLOW_LEFT);
+				}
+				if (aboveInBand && visits[cell - width].load(memory_order_relaxed) == 0)
+					flow.neighbourLowered(terrain, i - 1, col, FLOW_DOWN);
+				if (belowInBand && visits[cell + width].load(memory_order_relaxed) == 0)
+					flow.neighbourLowered(terrain, i + 1, col, FLOW_UP);
+			}
+		}
+
+		for (int k = rowStart[firstRow]; k < rowStart[lastRow]; k++)
+			visits[sorted[k]].store(0, memory_order_relaxed);
+	});
+	if (!sorted.empty())
+		flow.changed();
+
+	reached.clear();
+	roundOpen = false;
+}
+
+template class DropletErosion<float>;
+template class DropletErosion<double>;
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include "Heightfield.h"
+#include "Parallel.h"
+#include "FlowDirections.h"
+
+// A batch of erosion droplets drawn from the erosion stream of a seed.
+// Droplet number firstDroplet + k starts at a random cell and runs downhill like descendDroplet, lowering every cell
+// it passes by amount. Droplets are released in rounds of roundSize: the droplets of a round all follow the grid as it
+// was at the start of the round, and their lowerings are applied together when the round ends. Rounds are counted
+// from droplet 0 of the stream, round r holds droplets r * roundSize to (r + 1) * roundSize - 1, so the eroded
+// terrain only depends on which droplets ran and not on how they were split into batches.
+typedef struct {
+	uint64_t seed;
+	uint64_t firstDroplet;
+	int numDroplets;
+	int roundSize;
+	double amount;
+} DropletBatch;
+
+// Work done by a batch of droplets
+typedef struct {
+	long long droplets;
+	long long steps; // Cells eroded, summed over all droplets
+	double seconds;
+} ErosionStats;
+
+// A cell reached by the droplets of a round
+typedef struct {
+	int cell; // Index row * width + col
+	int row;
+} ReachedCell;
+
+// Batched droplet erosion. Keeps the flow directions of the terrain and the scratch of a round between batches,
+// so a batch costs time in proportion to the cells its droplets reach rather than to the size of the grid.
+template <typename T>
+class DropletErosion {
+public:
+	DropletErosion();
+
+	// Run a batch of droplets over terrain, the droplets of a round in parallel.
+	// Droplets follow the flow directions, which do not change during a round, and count the cells they pass with
+	// atomic integer adds into a shared grid of counts. When the round ends the counted cells are lowered and the
+	// directions around them recomputed, so the result does not depend on the thread count.
+	// The directions are built by the first batch and when the grid size changes; call reset() after the terrain
+	// was changed by anything else.
+	// A batch that ends inside a round leaves the round open: its droplets are counted but the terrain is only
+	// lowered once the next batch completes the round, so a run split into batches matches a single batch exactly.
+	// The terrain must not change while a round is open.
+	ErosionStats run(Heightfield<T>& terrain, const DropletBatch& batch, int numThreads);
+
+	// Lower the terrain for the droplets of an open round now, ending the round early
+	void finishRound(Heightfield<T>& terrain, int numThreads);
+
+	// True while the last batch ended inside a round
+	bool roundPending() const { return roundOpen; }
+
+	// Drop the flow directions and any open round, the next batch builds the directions again
+	void reset();
+
+	// Flow directions of the terrain after the last batch
+	const FlowDirections<T>& directions() const { return flow; }
+
+	// Every cell lowered by the last batch once, as index row * width + col
+	const std::vector<int>& loweredCells() const { return lowered; }
+
+private:
+	long long traceDroplets(const Heightfield<T>& terrain, uint64_t firstDroplet, int count, int numThreads);
+	void applyRound(Heightfield<T>& terrain, int numThreads);
+
+	FlowDirections<T> flow;
+	std::vector<std::atomic<int> > visits; // Droplets of the current round that passed each cell, zero between rounds
+	std::vector<int> rowStart; // Cells reached in row i are sorted[rowStart[i]] to sorted[rowStart[i + 1] - 1]
+	std::vector<int> rowFill;
+	std::vector<int> sorted;
+	std::vector<int> lowered;
+	std::vector<uint8_t> inLowered; // Cell is listed in lowered
+	std::vector<std::vector<ReachedCell> > reached; // Cells of the open round, each listed once by the thread that reached it first
+	DropletBatch open; // Droplets counted in the open round
+	bool roundOpen;
+};
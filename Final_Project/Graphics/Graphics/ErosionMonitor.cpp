@@ -0,0 +1,127 @@
+#include "ErosionMonitor.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+const int HISTOGRAM_BINS = 64;
+
+ConvergenceSettings defaultConvergenceSettings()
+{
+	ConvergenceSettings settings;
+	settings.windowDroplets = 1.0;
+	settings.windowPipeSteps = 50;
+	settings.flowChanges = 0.001;
+	settings.heightChange = 0.0001;
+	settings.waterChange = 0.001;
+	settings.histogramDrift = 0.01;
+	settings.patience = 3;
+	return settings;
+}
+
+ErosionMonitor::ErosionMonitor(const ConvergenceSettings& settings)
+	: settings(settings), pipe(false), windowUnits(1), units(0), unitsInWindow(0), quietWindows(0), convergedAt(-1), histogramLow(0), histogramBinWidth(1)
+{
+	ErosionWindow empty = { 0, 0, 0, 0, 0, 0, 0 };
+	window = empty;
+}
+
+// Histogram bin of a height, heights outside the range at reset go to the outer bins
+static int histogramBin(double height, double low, double binWidth)
+{
+	int bin = (int)floor((height - low) / binWidth);
+	return min(max(bin, 0), HISTOGRAM_BINS - 1);
+}
+
+void ErosionMonitor::reset(const HeightMap& terrain, bool pipe)
+{
+	this->pipe = pipe;
+	double cells = (double)terrain.height() * terrain.width();
+	windowUnits = pipe ? settings.windowPipeSteps : (long long)(settings.windowDroplets * cells);
+	windowUnits = max(1LL, windowUnits);
+	units = unitsInWindow = 0;
+	quietWindows = 0;
+	convergedAt = -1;
+	previous = terrain;
+	previousFlow.build(terrain, 1);
+
+	double low = terrain.empty() ? 0 : terrain(0, 0);
+	double high = low;
+	for (int i = 0; i < terrain.height(); i++)
+	{
+		for (int j = 0; j < terrain.width(); j++)
+		{
+			low = min(low, (double)terrain(i, j));
+			high = max(high, (double)terrain(i, j));
+		}
+	}
+	histogramLow = low;
+	histogramBinWidth = max(high - low, 1e-9) / HISTOGRAM_BINS;
+	histogram.assign(HISTOGRAM_BINS, 0);
+	for (int i = 0; i < terrain.height(); i++)
+		for (int j = 0; j < terrain.width(); j++)
+			histogram[histogramBin(terrain(i, j), histogramLow, histogramBinWidth)]++;
+
+	ErosionWindow first = { 0, 0, low, high, 0, 0, -1 }; // No water measured yet
+	window = first;
+}
+
+bool ErosionMonitor::record(const HeightMap& terrain, const HeightMap& waterHeight, long long batchUnits)
+{
+	units += batchUnits;
+	unitsInWindow += batchUnits;
+	if (unitsInWindow < windowUnits || terrain.empty())
+		return false;
+
+	// Compare with the terrain at the end of the last window
+	double cells = (double)terrain.height() * terrain.width();
+	double change = 0, water = 0;
+	double low = terrain(0, 0), high = low;
+	vector<int> bins(HISTOGRAM_BINS, 0);
+	for (int i = 0; i < terrain.height(); i++)
+	{
+		const HeightValue* row = terrain.row(i);
+		const HeightValue* before = previous.row(i);
+		const HeightValue* surface = waterHeight.row(i);
+		for (int j = 0; j < terrain.width(); j++)
+		{
+			change += fabs((double)row[j] - before[j]);
+			water += max(0.0, (double)surface[j] - row[j]);
+			low = min(low, (double)row[j]);
+			high = max(high, (double)row[j]);
+			bins[histogramBin(row[j], histogramLow, histogramBinWidth)]++;
+		}
+	}
+	int moved = 0;
+	for (int k = 0; k < HISTOGRAM_BINS; k++)
+		moved += abs(bins[k] - histogram[k]);
+	flow.build(terrain, 1);
+	int redirected = 0;
+	for (int k = 0; k < terrain.height() * terrain.width(); k++)
+		redirected += flow.code(k) != previousFlow.code(k);
+
+	window.units = units;
+	window.heightChange = change / cells;
+	window.minHeight = low;
+	window.maxHeight = high;
+	window.histogramDrift = moved / 2.0 / cells; // Every cell that moves leaves one bin and enters another
+	window.flowChanges = redirected / cells;
+	double previousWater = window.water;
+	window.water = water;
+	histogram.swap(bins);
+	previous = terrain;
+	swap(previousFlow, flow);
+	unitsInWindow = 0;
+
+	bool settled;
+	if (pipe)
+		settled = previousWater >= 0 && fabs(water - previousWater) <= settings.waterChange * water &&
+			window.heightChange < settings.heightChange * (high - low);
+	else
+		settled = window.flowChanges < settings.flowChanges;
+	bool quiet = settled && window.histogramDrift < settings.histogramDrift;
+	quietWindows = quiet ? quietWindows + 1 : 0;
+	if (quietWindows >= settings.patience && convergedAt < 0)
+		convergedAt = units;
+	return true;
+}
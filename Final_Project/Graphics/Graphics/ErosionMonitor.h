@@ -0,0 +1,74 @@
+#pragma once
+#include <vector>
+#include "Heightfield.h"
+#include "FlowDirections.h"
+
+// Watches erosion for the point where it stops changing the terrain in any way that shows. Batches are summed into
+// windows of one droplet per cell (or a fixed number of pipe steps); at the end of every window the terrain is
+// compared with the previous window: the mean height change, the lowest and highest cell, how far the height
+// histogram drifted, how many cells drain in another direction and how much water stands on the terrain. Droplets
+// lower the cells they pass forever, so heights never settle; what settles is the drainage network, and droplet
+// erosion counts as converged once flow directions change on few cells. Rain in the pipe model keeps moving its
+// channels, so its flow never settles; what settles is the water, and pipe erosion counts as converged once the water
+// on the terrain stays the same and the terrain moves by a small fraction of its height range per window. Either
+// test has to pass, with the histogram steady, for several windows in a row.
+
+// Thresholds of convergence, fractions are of the cells of the grid per window
+typedef struct {
+	double windowDroplets; // Droplets per cell in a window
+	int windowPipeSteps; // Pipe model steps in a window
+	double flowChanges; // Droplets converge below this fraction of cells changing direction
+	double heightChange; // The pipe model converges below this mean height change, as a fraction of the height range...
+	double waterChange; // ...with the water on the terrain changing by less than this fraction of it
+	double histogramDrift; // And the height histogram moved less than this fraction of the cells
+	int patience; // Windows in a row that have to pass
+} ConvergenceSettings;
+
+ConvergenceSettings defaultConvergenceSettings();
+
+// Measurements of one window
+typedef struct {
+	long long units; // Droplets or pipe steps since the monitor started, at the end of the window
+	double heightChange; // Mean absolute height change per cell
+	double minHeight, maxHeight;
+	double histogramDrift; // Fraction of the cells that moved to another bin of the height histogram
+	double flowChanges; // Fraction of the cells whose flow direction changed
+	double water; // Depth of the water above the terrain, summed over all cells
+} ErosionWindow;
+
+class ErosionMonitor {
+public:
+	ErosionMonitor(const ConvergenceSettings& settings);
+
+	// Start watching terrain eroded by droplets, or by the pipe model when pipe is set
+	void reset(const HeightMap& terrain, bool pipe);
+
+	// Account for a batch of batchUnits droplets or pipe steps. Returns true when the batch completed a window.
+	bool record(const HeightMap& terrain, const HeightMap& waterHeight, long long batchUnits);
+
+	// Droplets or pipe steps left until the current window ends
+	long long unitsToWindowEnd() const { return windowUnits - unitsInWindow; }
+
+	bool converged() const { return convergedAt >= 0; }
+
+	// Droplets or pipe steps run when convergence was detected, -1 before
+	long long convergenceUnits() const { return convergedAt; }
+
+	// Measurements of the last completed window
+	const ErosionWindow& lastWindow() const { return window; }
+
+private:
+	ConvergenceSettings settings;
+	bool pipe;
+	long long windowUnits; // Droplets or pipe steps per window
+	long long units; // Since reset
+	long long unitsInWindow;
+	int quietWindows; // Windows in a row below the thresholds
+	long long convergedAt;
+	ErosionWindow window;
+
+	HeightMap previous; // Terrain at the end of the last window
+	FlowDirections<HeightValue> previousFlow, flow;
+	double histogramLow, histogramBinWidth; // Bins cover the height range of the terrain at reset
+	std::vector<int> histogram;
+};
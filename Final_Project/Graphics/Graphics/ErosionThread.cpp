@@ -0,0 +1,131 @@
+#include "ErosionThread.h"
+#include "World.h"
+#include <chrono>
+
+using namespace std;
+
+const int SNAPSHOT_INDEX = 3; // Bits of ErosionThread::ready holding the buffer index
+const int SNAPSHOT_FRESH = 4; // Set in ErosionThread::ready while the published buffer has not been drawn
+const int BATCH_DROPLETS = 256; // Droplets released between two checks for a snapshot to publish
+const int BATCH_PIPE_STEPS = 4; // Pipe model steps between two checks for a snapshot to publish
+const int IDLE_POLL_MILLISECONDS = 50; // How often a worker whose erosion converged checks whether it was stopped
+
+ErosionThread::ErosionThread()
+	: pipeModel(defaultPipeSettings()), monitor(defaultConvergenceSettings()), back(2), front(0), ready(1), stopping(false), batchCount(0), convergedAt(-1)
+{
+}
+
+ErosionThread::~ErosionThread()
+{
+	if (running())
+	{
+		stopping = true;
+		worker.join();
+	}
+}
+
+void ErosionThread::start(const HeightMap& terrain, const HeightMap& waterHeight, bool pipe, bool lakes)
+{
+	if (running())
+		return;
+	this->terrain = terrain;
+	this->waterHeight = waterHeight;
+
+	// The renderer starts on a copy of the initial grids, the two other buffers are free
+	snapshots[0].terrain = terrain;
+	snapshots[0].waterHeight = waterHeight;
+	front = 0;
+	ready = 1;
+	back = 2;
+
+	stopping = false;
+	batchCount = 0;
+	convergedAt = -1;
+	worker = thread(&ErosionThread::workerLoop, this, pipe, lakes);
+}
+
+void ErosionThread::stop(HeightMap& terrain, HeightMap& waterHeight)
+{
+	if (!running())
+		return;
+	stopping = true;
+	worker.join();
+	terrain = this->terrain;
+	waterHeight = this->waterHeight;
+}
+
+void ErosionThread::workerLoop(bool pipe, bool lakes)
+{
+	// The grids may have changed since the last run: rivers placed, cells flattened by the city or a world loaded
+	droplets.reset();
+	if (pipe)
+		pipeModel.start(terrain, waterHeight);
+	lakes = lakes && !pipe; // The pipe model moves its own water
+	if (lakes)
+	{
+		lakeFill.build(terrain, 0);
+		lakeFill.writeLakes(waterHeight);
+	}
+
+	monitor.reset(terrain, pipe);
+
+	while (!stopping.load())
+	{
+		if (monitor.converged())
+		{
+			// Nothing changes any more that would show, the worker sleeps until it is stopped
+			this_thread::sleep_for(chrono::milliseconds(IDLE_POLL_MILLISECONDS));
+			continue;
+		}
+
+		if (pipe)
+			pipeErosion(terrain, waterHeight, BATCH_PIPE_STEPS, &pipeModel);
+		else
+			hydraulicErosion(terrain, BATCH_DROPLETS, &droplets);
+		if (lakes)
+			lakeFill.update(terrain, droplets.loweredCells(), waterHeight);
+		batchCount++;
+
+		monitor.record(terrain, waterHeight, pipe ? BATCH_PIPE_STEPS : BATCH_DROPLETS);
+		if (monitor.converged())
+		{
+			completeRound(pipe, lakes);
+			publish(); // The last snapshot has to reach the renderer even if it has not taken the previous one
+			lastWindow = monitor.lastWindow(); // Written before convergedAt publishes it
+			convergedAt = monitor.convergenceUnits();
+			continue;
+		}
+
+		// Copying a snapshot the renderer would never see is wasted work, so wait until it took the last one
+		if ((ready.load() & SNAPSHOT_FRESH) == 0)
+			publish();
+	}
+
+	if (!monitor.converged())
+		completeRound(pipe, lakes);
+}
+
+// Stop at a round boundary, so the grids handed back (and saved) continue exactly like an uninterrupted run
+void ErosionThread::completeRound(bool pipe, bool lakes)
+{
+	if (pipe)
+		return;
+	completeErosionRound(terrain, droplets);
+	if (lakes)
+		lakeFill.update(terrain, droplets.loweredCells(), waterHeight);
+}
+
+// Copy the worker's grids into the back buffer and swap it with the published one
+void ErosionThread::publish()
+{
+	snapshots[back].terrain = terrain;
+	snapshots[back].waterHeight = waterHeight;
+	back = ready.exchange(back | SNAPSHOT_FRESH) & SNAPSHOT_INDEX;
+}
+
+const ErosionThread::Snapshot& ErosionThread::latest()
+{
+	if (ready.load() & SNAPSHOT_FRESH)
+		front = ready.exchange(front) & SNAPSHOT_INDEX;
+	return snapshots[front];
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include "Heightfield.h"
+#include "DropletErosion.h"
+#include "PipeErosion.h"
+#include "LakeFill.h"
+#include "ErosionMonitor.h"
+
+// Erosion on a worker thread, decoupled from rendering. The worker erodes its own copy of the terrain and water and,
+// whenever the renderer has picked up the previous snapshot, copies them into a free snapshot buffer and publishes it
+// with one atomic exchange. Three snapshot buffers rotate between the worker and the renderer, so neither ever waits
+// for the other: the worker always has a buffer to fill and the renderer always has a complete one to draw.
+class ErosionThread {
+public:
+	// Terrain and water as of the end of an erosion batch
+	typedef struct {
+		HeightMap terrain;
+		HeightMap waterHeight;
+	} Snapshot;
+
+	ErosionThread();
+	~ErosionThread();
+
+	// Start eroding copies of terrain and waterHeight with droplets, or with the pipe model when pipe is set.
+	// With lakes set the depressions of the droplet-eroded terrain are kept filled with lakes in waterHeight.
+	void start(const HeightMap& terrain, const HeightMap& waterHeight, bool pipe, bool lakes);
+
+	// Stop the worker and copy the eroded grids back into terrain and waterHeight
+	void stop(HeightMap& terrain, HeightMap& waterHeight);
+
+	bool running() const { return worker.joinable(); }
+
+	// Most recently published snapshot, stays valid and unchanged until the next call. Render thread only.
+	const Snapshot& latest();
+
+	// Erosion batches completed since start
+	long long batches() const { return batchCount.load(); }
+
+	// True once the erosion monitor found that the terrain no longer changes noticeably. The worker then publishes a
+	// last snapshot and sleeps until it is stopped.
+	bool converged() const { return convergedAt.load() >= 0; }
+
+	// Droplets (or pipe steps) run since start when erosion converged, -1 before
+	long long convergenceUnits() const { return convergedAt.load(); }
+
+	// Measurements of the window in which erosion converged, valid once converged() is true
+	const ErosionWindow& convergenceWindow() const { return lastWindow; }
+
+private:
+	void workerLoop(bool pipe, bool lakes);
+	void completeRound(bool pipe, bool lakes);
+	void publish();
+
+	// Worker's grids, only touched by the worker while it runs
+	HeightMap terrain;
+	HeightMap waterHeight;
+	DropletErosion<HeightValue> droplets; // Keeps the flow directions of terrain between batches
+	PipeErosion<HeightValue> pipeModel; // Water, sediment and flows of the pipe model between batches
+	LakeFill<HeightValue> lakeFill; // Spill levels of terrain, updated around the cells every batch lowers
+	ErosionMonitor monitor;
+	ErosionWindow lastWindow;
+
+	Snapshot snapshots[3];
+	int back; // Buffer the worker fills next
+	int front; // Buffer the renderer is drawing
+	std::atomic<int> ready; // Buffer last published, with SNAPSHOT_FRESH set until the renderer takes it
+
+	std::atomic<bool> stopping;
+	std::atomic<long long> batchCount;
+	std::atomic<long long> convergedAt;
+	std::thread worker;
+};
@@ -0,0 +1,78 @@
+#include "FlowAccumulation.h"
+#include <stdint.h>
+
+using namespace std;
+
+template <typename T>
+void accumulateFlow(const FlowDirections<T>& directions, SinkIndex<T>& sinks, vector<int>& drained, int numThreads)
+{
+	int height = directions.height();
+	int width = directions.width();
+	int cells = height * width;
+	drained.assign(cells, 1);
+	if (cells == 0)
+		return;
+
+	// Number of neighbours flowing into every cell, each thread counts its own rows
+	vector<uint8_t> inflow(cells);
+	parallelRange(0, height, numThreads, [&](int firstRow, int lastRow)
+	{
+		for (int i = firstRow; i < lastRow; i++)
+			for (int j = 0; j < width; j++)
+			{
+				int cell = i * width + j;
+				int count = 0;
+				if (i < height - 1 && directions.code(cell + width) == FLOW_UP)
+					count++;
+				if (j < width - 1 && directions.code(cell + 1) == FLOW_LEFT)
+					count++;
+				if (i > 0 && directions.code(cell - width) == FLOW_DOWN)
+					count++;
+				if (j > 0 && directions.code(cell - 1) == FLOW_RIGHT)
+					count++;
+				inflow[cell] = (uint8_t)count;
+			}
+	});
+
+	// Cells nothing flows into start the walk; they go to the thread owning the band of rows of their minimum
+	int owners = max(1, min(numThreads, height));
+	vector<int> ownerStart(owners + 1, 0);
+	vector<int> sourceOwner;
+	vector<int> sources;
+	for (int cell = 0; cell < cells; cell++)
+		if (inflow[cell] == 0)
+		{
+			int owner = (int)((long long)(sinks.sink(cell) / width) * owners / height);
+			sources.push_back(cell);
+			sourceOwner.push_back(owner);
+			ownerStart[owner + 1]++;
+		}
+	for (int k = 0; k < owners; k++)
+		ownerStart[k + 1] += ownerStart[k];
+	vector<int> ownerFill(ownerStart.begin(), ownerStart.end() - 1);
+	vector<int> sorted(sources.size());
+	for (size_t k = 0; k < sources.size(); k++)
+		sorted[ownerFill[sourceOwner[k]]++] = sources[k];
+
+	// Follow every source downhill, handing its count to the next cell, until a cell still waits for another branch
+	parallelRange(0, owners, owners, [&](int firstOwner, int lastOwner)
+	{
+		for (int k = ownerStart[firstOwner]; k < ownerStart[lastOwner]; k++)
+		{
+			int cell = sorted[k];
+			while (true)
+			{
+				int below = directions.next(cell);
+				if (below == cell)
+					break;
+				drained[below] += drained[cell];
+				if (--inflow[below] > 0)
+					break;
+				cell = below;
+			}
+		}
+	});
+}
+
+template void accumulateFlow(const FlowDirections<float>& directions, SinkIndex<float>& sinks, vector<int>& drained, int numThreads);
+template void accumulateFlow(const FlowDirections<double>& directions, SinkIndex<double>& sinks, vector<int>& drained, int numThreads);
@@ -0,0 +1,15 @@
+#pragma once
+#include <vector>
+#include "FlowDirections.h"
+#include "SinkIndex.h"
+
+// Flow accumulation over the flow directions: the number of cells whose water passes through every cell, the cell
+// itself included, when one unit of rain falls on each cell and runs downhill. The directions form a forest of
+// drainage basins, each a tree rooted at its local minimum, so the counts follow in one topological pass (Kahn's
+// algorithm): a cell is final once all the cells flowing into it are, and is then added to the cell below it.
+// Basins do not share cells, so every thread walks the basins whose minimum lies in its band of rows.
+
+// Count the cells draining through every cell of directions into drained, indexed row * width + col.
+// sinks is attached to directions and assigns the sources of the walk to their basins.
+template <typename T>
+void accumulateFlow(const FlowDirections<T>& directions, SinkIndex<T>& sinks, std::vector<int>& drained, int numThreads);
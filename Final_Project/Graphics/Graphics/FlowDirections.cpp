@@ -0,0 +1,50 @@
+#include "FlowDirections.h"
+
+using namespace std;
+
+template <typename T>
+FlowDirections<T>::FlowDirections()
+	: rows(0), cols(0), changes(0)
+{
+	for (int k = 0; k < 5; k++)
+		offsets[k] = 0;
+}
+
+template <typename T>
+void FlowDirections<T>::build(const Heightfield<T>& terrain, int numThreads)
+{
+	rows = terrain.height();
+	cols = terrain.width();
+	codes.assign((size_t)rows * cols, FLOW_NONE);
+	changes++;
+	offsets[FLOW_NONE] = 0;
+	offsets[FLOW_DOWN] = cols;
+	offsets[FLOW_RIGHT] = 1;
+	offsets[FLOW_UP] = -cols;
+	offsets[FLOW_LEFT] = -1;
+
+	parallelRange(0, rows, numThreads, [this, &terrain](int firstRow, int lastRow)
+	{
+		for (int i = firstRow; i < lastRow; i++)
+			for (int j = 0; j < cols; j++)
+				refresh(terrain, i, j);
+	});
+}
+
+template <typename T>
+void FlowDirections<T>::update(const Heightfield<T>& terrain, int row, int col)
+{
+	changes++;
+	refresh(terrain, row, col);
+	if (row < rows - 1)
+		refresh(terrain, row + 1, col);
+	if (col < cols - 1)
+		refresh(terrain, row, col + 1);
+	if (row > 0)
+		refresh(terrain, row - 1, col);
+	if (col > 0)
+		refresh(terrain, row, col - 1);
+}
+
+template class FlowDirections<float>;
+template class FlowDirections<double>;
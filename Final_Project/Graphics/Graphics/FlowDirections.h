@@ -0,0 +1,102 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Heightfield.h"
+#include "Parallel.h"
+
+// Steepest descent direction of every cell among its four neighbours, the step a droplet takes from it.
+// The direction is the strictly lowest neighbour, ties going to the earlier of down, right, up, left (the order
+// descendDroplet checks them in); a cell without a lower neighbour is a local minimum. Cells are addressed by
+// index row * width + col, and following a droplet costs one load per step instead of four height comparisons.
+// The map is kept current by the code that lowers cells: after a cell changes, update() recomputes the cell and
+// the neighbours that may now drain into it.
+enum FlowCode {
+	FLOW_NONE, // Local minimum
+	FLOW_DOWN, // Towards row + 1
+	FLOW_RIGHT, // Towards col + 1
+	FLOW_UP, // Towards row - 1
+	FLOW_LEFT // Towards col - 1
+};
+
+// Row and column change of every code
+const int FLOW_ROW_OFFSETS[5] = { 0, 1, 0, -1, 0 };
+const int FLOW_COL_OFFSETS[5] = { 0, 0, 1, 0, -1 };
+
+template <typename T>
+class FlowDirections {
+public:
+	FlowDirections();
+
+	// Compute the direction of every cell of terrain
+	void build(const Heightfield<T>& terrain, int numThreads);
+
+	// Recompute the cell at (row, col) and its four neighbours after the height of the cell changed
+	void update(const Heightfield<T>& terrain, int row, int col);
+
+	// Direction code of the cell at (row, col)
+	static uint8_t steepestDescent(const Heightfield<T>& terrain, int row, int col)
+	{
+		uint8_t code = FLOW_NONE;
+		T lowest = terrain(row, col);
+		if (row < terrain.height() - 1 && terrain(row + 1, col) < lowest) {
+			lowest = terrain(row + 1, col);
+			code = FLOW_DOWN;
+		}
+		if (col < terrain.width() - 1 && terrain(row, col + 1) < lowest) {
+			lowest = terrain(row, col + 1);
+			code = FLOW_RIGHT;
+		}
+		if (row > 0 && terrain(row - 1, col) < lowest) {
+			lowest = terrain(row - 1, col);
+			code = FLOW_UP;
+		}
+		if (col > 0 && terrain(row, col - 1) < lowest) {
+			code = FLOW_LEFT;
+		}
+		return code;
+	}
+
+	// Recompute the cell at (row, col) only
+	void refresh(const Heightfield<T>& terrain, int row, int col)
+	{
+		codes[(size_t)row * cols + col] = steepestDescent(terrain, row, col);
+	}
+
+	// Reconsider the cell at (row, col), whose own height did not change, after its neighbour in direction code
+	// was lowered. Only that neighbour can have become its steepest descent, so it is compared with the current one.
+	void neighbourLowered(const Heightfield<T>& terrain, int row, int col, uint8_t code)
+	{
+		uint8_t& current = codes[(size_t)row * cols + col];
+		T candidate = terrain(row + FLOW_ROW_OFFSETS[code], col + FLOW_COL_OFFSETS[code]);
+		T lowest = terrain(row + FLOW_ROW_OFFSETS[current], col + FLOW_COL_OFFSETS[current]);
+		if (candidate < lowest || (candidate == lowest && current != FLOW_NONE && code < current))
+			current = code;
+	}
+
+	// Count a change made to the codes from outside, by refresh() or neighbourLowered(). Those run on many threads
+	// at once, so the code lowering cells calls this once after each pass instead.
+	void changed() { changes++; }
+
+	// Number of times the map was built or changed, for the code memoizing walks over it
+	uint64_t revision() const { return changes; }
+
+	// True when the map was built for a grid of this size
+	bool matches(const Heightfield<T>& terrain) const { return rows == terrain.height() && cols == terrain.width(); }
+
+	int height() const { return rows; }
+	int width() const { return cols; }
+
+	uint8_t code(int index) const { return codes[index]; }
+
+	// Index change of a step in direction code
+	int offset(uint8_t code) const { return offsets[code]; }
+
+	// Index of the cell a droplet moves to from index, or index itself in a local minimum
+	int next(int index) const { return index + offsets[codes[index]]; }
+
+private:
+	std::vector<uint8_t> codes;
+	int rows, cols;
+	int offsets[5]; // Index change of every code
+	uint64_t changes;
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// A runtime-sized 2D grid of heights stored row by row in one aligned block.
+// Rows are padded to a multiple of HEIGHTFIELD_ALIGNMENT bytes, so every row starts aligned for vector loads;
+// stride() is the distance between rows in elements. Cells are addressed as (row, col) like the old [row][col] arrays.
+const size_t HEIGHTFIELD_ALIGNMENT = 64;
+
+template <typename T>
+class Heightfield {
+public:
+	typedef T Value;
+
+	Heightfield()
+		: cells(NULL), block(NULL), rows(0), cols(0), rowStride(0)
+	{
+	}
+
+	Heightfield(int height, int width)
+		: cells(NULL), block(NULL), rows(0), cols(0), rowStride(0)
+	{
+		resize(height, width);
+	}
+
+	Heightfield(const Heightfield& other)
+		: cells(NULL), block(NULL), rows(0), cols(0), rowStride(0)
+	{
+		*this = other;
+	}
+
+	~Heightfield()
+	{
+		release();
+	}
+
+	Heightfield& operator=(const Heightfield& other)
+	{
+		if (this != &other)
+		{
+			// Owned storage of the right size is reused, snapshots are copied over and over
+			if (block == NULL || rows != other.rows || cols != other.cols)
+				resize(other.rows, other.cols);
+			for (int r = 0; r < rows; r++)
+				memcpy(row(r), other.row(r), cols * sizeof(T));
+		}
+		return *this;
+	}
+
+	// Reallocate for height x width cells, all set to zero
+	void resize(int height, int width)
+	{
+		release();
+		rows = height;
+		cols = width;
+		size_t perRow = HEIGHTFIELD_ALIGNMENT / sizeof(T);
+		rowStride = (int)(((size_t)width + perRow - 1) / perRow * perRow);
+
+		size_t bytes = (size_t)rows * rowStride * sizeof(T);
+		block = new char[bytes + HEIGHTFIELD_ALIGNMENT];
+		cells = (T*)(((uintptr_t)block + HEIGHTFIELD_ALIGNMENT - 1) & ~(uintptr_t)(HEIGHTFIELD_ALIGNMENT - 1));
+		memset(cells, 0, bytes);
+	}
+
+	// Use height x width cells at storage, rows stride elements apart, without copying them.
+	// The storage is not owned: it has to outlive the heightfield, or the next resize or assignment.
+	void wrap(T* storage, int height, int width, int stride)
+	{
+		release();
+		cells = storage;
+		rows = height;
+		cols = width;
+		rowStride = stride;
+	}
+
+	void fill(T value)
+	{
+		for (int r = 0; r < rows; r++)
+		{
+			T* cell = row(r);
+			for (int c = 0; c < cols; c++)
+				cell[c] = value;
+		}
+	}
+
+	int height() const { return rows; }
+	int width() const { return cols; }
+	int stride() const { return rowStride; }
+	bool empty() const { return rows == 0 || cols == 0; }
+
+	bool contains(int r, int c) const
+	{
+		return r >= 0 && r < rows && c >= 0 && c < cols;
+	}
+
+	T* row(int r) { return cells + (size_t)r * rowStride; }
+	const T* row(int r) const { return cells + (size_t)r * rowStride; }
+
+	T& operator()(int r, int c) { return cells[(size_t)r * rowStride + c]; }
+	const T& operator()(int r, int c) const { return cells[(size_t)r * rowStride + c]; }
+
+	// Bytes used by the cells including row padding
+	size_t bytes() const { return (size_t)rows * rowStride * sizeof(T); }
+
+private:
+	void release()
+	{
+		delete[] block;
+		block = NULL;
+		cells = NULL;
+		rows = cols = rowStride = 0;
+	}
+
+	T* cells;
+	char* block;
+	int rows, cols;
+	int rowStride;
+};
+
+// Storage type of the application's height maps: float, half the memory and bandwidth of double for the terrain,
+// the water layer and every plane of the pipe model. Defining TERRAIN_DOUBLE_HEIGHTS stores doubles instead.
+#ifdef TERRAIN_DOUBLE_HEIGHTS
+typedef double HeightValue;
+#else
+typedef float HeightValue;
+#endif
+
+typedef Heightfield<HeightValue> HeightMap;
@@ -0,0 +1,304 @@
+#include "LakeFill.h"
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// States of a cell during a flood
+const uint8_t CELL_DONE = 0; // Level is final
+const uint8_t CELL_PENDING = 1; // Not reached by the flood yet
+const uint8_t CELL_SEEDED = 2; // Flood started here, final once the flood ends
+
+const double DRY_OFFSET = 0.001; // Water surface below the terrain of a dry cell, as in initializeWaterHeight
+
+// Map a height to an unsigned key in the same order: positive doubles sort like their bits, negative ones in reverse
+static uint64_t heightKey(double height)
+{
+	uint64_t bits;
+	memcpy(&bits, &height, sizeof(bits));
+	return (bits >> 63) ? ~bits : bits | ((uint64_t)1 << 63);
+}
+
+// Index of the highest set bit plus one, 0 for 0
+static inline int bitLength(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_IX86)
+	// 32-bit builds only have the 32-bit scans, applied to the high half first
+	unsigned long index;
+	if (_BitScanReverse(&index, (unsigned long)(x >> 32)))
+		return (int)index + 33;
+	return _BitScanReverse(&index, (unsigned long)x) ? (int)index + 1 : 0;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	return _BitScanReverse64(&index, x) ? (int)index + 1 : 0;
+#else
+	return x ? 64 - __builtin_clzll(x) : 0;
+#endif
+}
+
+// Index of the lowest set bit of a non-zero x
+static inline int lowestBit(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_IX86)
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)x))
+		return (int)index;
+	_BitScanForward(&index, (unsigned long)(x >> 32));
+	return (int)index + 32;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+template <typename T>
+LakeFill<T>::LakeFill()
+	: sea(0), lastKey(0), heapSize(0), usedBuckets(0)
+{
+}
+
+template <typename T>
+void LakeFill<T>::push(T height, int cell)
+{
+	HeapEntry entry = { heightKey(height), cell };
+	int k = bitLength(entry.key ^ lastKey);
+	buckets[k].push_back(entry);
+	if (k > 0)
+		usedBuckets |= (uint64_t)1 << (k - 1);
+	heapSize++;
+}
+
+template <typename T>
+bool LakeFill<T>::pop(HeapEntry& entry)
+{
+	if (heapSize == 0)
+		return false;
+	if (buckets[0].empty())
+	{
+		// The smallest key of the first non-empty bucket becomes the last key, and every entry of that bucket then
+		// differs from it in a lower bit, so each entry moves to a lower bucket at most 64 times in total
+		int k = lowestBit(usedBuckets) + 1;
+		vector<HeapEntry>& bucket = buckets[k];
+		uint64_t smallest = bucket[0].key;
+		for (size_t i = 1; i < bucket.size(); i++)
+			if (bucket[i].key < smallest)
+				smallest = bucket[i].key;
+		lastKey = smallest;
+		usedBuckets &= ~((uint64_t)1 << (k - 1));
+		for (size_t i = 0; i < bucket.size(); i++)
+		{
+			int lower = bitLength(bucket[i].key ^ lastKey);
+			buckets[lower].push_back(bucket[i]);
+			if (lower > 0)
+				usedBuckets |= (uint64_t)1 << (lower - 1);
+		}
+		bucket.clear();
+	}
+	entry = buckets[0].back();
+	buckets[0].pop_back();
+	heapSize--;
+	return true;
+}
+
+template <typename T>
+void LakeFill<T>::seed(const Heightfield<T>& terrain, int row, int col, T height)
+{
+	int cell = row * terrain.width() + col;
+	if (state[cell] == CELL_SEEDED)
+		return;
+	state[cell] = CELL_SEEDED;
+	level(row, col) = height;
+	push(height, cell);
+	seeded.push_back(cell);
+}
+
+template <typename T>
+void LakeFill<T>::flood(const Heightfield<T>& terrain)
+{
+	int height = terrain.height();
+	int width = terrain.width();
+	HeapEntry entry;
+	while (pop(entry))
+	{
+		pits.push_back(entry.cell);
+		while (!pits.empty())
+		{
+			int cell = pits.back();
+			pits.pop_back();
+			int row = cell / width;
+			int col = cell - row * width;
+			T current = level(row, col);
+
+			int neighbours[4] = { cell + width, cell + 1, cell - width, cell - 1 };
+			bool inside[4] = { row < height - 1, col < width - 1, row > 0, col > 0 };
+			for (int k = 0; k < 4; k++)
+			{
+				int next = neighbours[k];
+				if (!inside[k] || state[next] != CELL_PENDING)
+					continue;
+				state[next] = CELL_DONE;
+				int nextRow = next / width;
+				int nextCol = next - nextRow * width;
+				T ground = terrain(nextRow, nextCol);
+				if (ground <= current)
+				{
+					// In a depression: the water rises to the level it spills over at
+					level(nextRow, nextCol) = current;
+					pits.push_back(next);
+				}
+				else
+				{
+					level(nextRow, nextCol) = ground;
+					push(ground, next);
+				}
+			}
+		}
+	}
+
+	for (size_t k = 0; k < seeded.size(); k++)
+		state[seeded[k]] = CELL_DONE;
+	seeded.clear();
+	lastKey = 0;
+}
+
+template <typename T>
+void LakeFill<T>::build(const Heightfield<T>& terrain, T seaLevel)
+{
+	int height = terrain.height();
+	int width = terrain.width();
+	sea = seaLevel;
+	if (!matches(terrain))
+		level.resize(height, width);
+	state.assign((size_t)height * width, CELL_PENDING);
+
+	// Every sea cell keeps its own height. Only the coast is seeded: the open sea lies below all land, so cells
+	// away from the coast would only be popped to find no pending neighbour.
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			if (terrain(i, j) < sea)
+			{
+				state[i * width + j] = CELL_DONE;
+				level(i, j) = terrain(i, j);
+			}
+		}
+	}
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			bool border = i == 0 || j == 0 || i == height - 1 || j == width - 1;
+			bool coast = terrain(i, j) < sea && ((i < height - 1 && terrain(i + 1, j) >= sea) || (j < width - 1 && terrain(i, j + 1) >= sea) ||
+				(i > 0 && terrain(i - 1, j) >= sea) || (j > 0 && terrain(i, j - 1) >= sea));
+			if (border || coast)
+				seed(terrain, i, j, terrain(i, j));
+		}
+	}
+	flood(terrain);
+
+	flooded.assign((size_t)height * width, 0);
+	for (int i = 0; i < height; i++)
+		for (int j = 0; j < width; j++)
+			flooded[i * width + j] = level(i, j) > terrain(i, j);
+}
+
+template <typename T>
+void LakeFill<T>::update(const Heightfield<T>& terrain, const vector<int>& lowered, Heightfield<T>& waterHeight)
+{
+	if (!matches(terrain))
+	{
+		build(terrain, sea);
+		writeLakes(waterHeight);
+		return;
+	}
+
+	int height = terrain.height();
+	int width = terrain.width();
+
+	// The region is the lowered cells and every lake they lie in or border, grown breadth first over lake cells
+	region.clear();
+	for (size_t k = 0; k < lowered.size(); k++)
+	{
+		if (state[lowered[k]] == CELL_DONE)
+		{
+			state[lowered[k]] = CELL_PENDING;
+			region.push_back(lowered[k]);
+		}
+	}
+	for (size_t k = 0; k < region.size(); k++)
+	{
+		int cell = region[k];
+		int row = cell / width;
+		int col = cell - row * width;
+		int neighbours[4] = { cell + width, cell + 1, cell - width, cell - 1 };
+		bool inside[4] = { row < height - 1, col < width - 1, row > 0, col > 0 };
+		for (int n = 0; n < 4; n++)
+		{
+			if (inside[n] && flooded[neighbours[n]] && state[neighbours[n]] == CELL_DONE)
+			{
+				state[neighbours[n]] = CELL_PENDING;
+				region.push_back(neighbours[n]);
+			}
+		}
+	}
+
+	// The region floods again from its border cells and from the unchanged levels around it
+	for (size_t k = 0; k < region.size(); k++)
+	{
+		int row = region[k] / width;
+		int col = region[k] - row * width;
+		if (row == 0 || col == 0 || row == height - 1 || col == width - 1 || terrain(row, col) < sea)
+			seed(terrain, row, col, terrain(row, col));
+	}
+	for (size_t k = 0; k < region.size(); k++)
+	{
+		int cell = region[k];
+		int row = cell / width;
+		int col = cell - row * width;
+		int rows[4] = { row + 1, row, row - 1, row };
+		int cols[4] = { col, col + 1, col, col - 1 };
+		for (int n = 0; n < 4; n++)
+			if (terrain.contains(rows[n], cols[n]) && state[rows[n] * width + cols[n]] == CELL_DONE)
+				seed(terrain, rows[n], cols[n], level(rows[n], cols[n]));
+	}
+	flood(terrain);
+
+	for (size_t k = 0; k < region.size(); k++)
+	{
+		int row = region[k] / width;
+		int col = region[k] - row * width;
+		bool lake = level(row, col) > terrain(row, col);
+		if (lake)
+			waterHeight(row, col) = level(row, col);
+		else if (flooded[region[k]])
+			waterHeight(row, col) = (T)(terrain(row, col) - DRY_OFFSET);
+		flooded[region[k]] = lake;
+	}
+}
+
+template <typename T>
+int LakeFill<T>::writeLakes(Heightfield<T>& waterHeight) const
+{
+	int lakeCells = 0;
+	for (int i = 0; i < level.height(); i++)
+	{
+		for (int j = 0; j < level.width(); j++)
+		{
+			if (flooded[i * level.width() + j])
+			{
+				waterHeight(i, j) = level(i, j);
+				lakeCells++;
+			}
+		}
+	}
+	return lakeCells;
+}
+
+template class LakeFill<float>;
+template class LakeFill<double>;
@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Heightfield.h"
+
+// Lakes by priority-flood depression filling. The spill level of a cell is the lowest height water standing on it
+// has to rise to before it can run off to the sea or the edge of the grid, the lowest over all paths of the highest
+// cell on the path; cells below their spill level lie in a lake. The flood grows inwards from the sea and border
+// cells, always from the lowest cell reached so far: a cell reached from a higher level lies in a depression and
+// takes that level. Levels are popped in increasing order from a radix heap, so every operation costs a few bucket
+// moves instead of the log n of a binary heap, and cells inside a depression bypass the heap through a plain queue.
+//
+// Erosion only lowers cells, which can only change the levels of the lowered cells and of the lakes they lie in or
+// border: every other cell keeps its level. update() floods that region again from its unchanged surroundings.
+template <typename T>
+class LakeFill {
+public:
+	LakeFill();
+
+	// Compute the spill level of every cell of terrain, cells below seaLevel are sea and drain directly
+	void build(const Heightfield<T>& terrain, T seaLevel);
+
+	// Recompute after the cells at index row * width + col in lowered were lowered, and write the lakes of the
+	// recomputed region into waterHeight like writeLakes(). Cells that no longer lie in a lake become dry.
+	void update(const Heightfield<T>& terrain, const std::vector<int>& lowered, Heightfield<T>& waterHeight);
+
+	// Set the water surface of every lake cell to its spill level, other cells keep their water.
+	// Returns the number of lake cells.
+	int writeLakes(Heightfield<T>& waterHeight) const;
+
+	// Spill level of every cell
+	const Heightfield<T>& levels() const { return level; }
+
+	// True when build() was called for a grid of this size
+	bool matches(const Heightfield<T>& terrain) const { return level.height() == terrain.height() && level.width() == terrain.width(); }
+
+private:
+	// Flood the pending cells from the seeds pushed into the heap
+	void flood(const Heightfield<T>& terrain);
+
+	void seed(const Heightfield<T>& terrain, int row, int col, T height);
+
+	Heightfield<T> level;
+	std::vector<uint8_t> state; // CELL_DONE, CELL_PENDING or CELL_SEEDED, see LakeFill.cpp
+	std::vector<uint8_t> flooded; // Cell lay below its spill level after the last build or update
+	T sea;
+
+	// Radix heap of (level, cell) entries; keys are levels mapped to unsigned integers in the same order, bucket k
+	// holds the keys that first differ from the last popped key in bit k - 1
+	typedef struct {
+		uint64_t key;
+		int cell;
+	} HeapEntry;
+	void push(T height, int cell);
+	bool pop(HeapEntry& entry);
+	std::vector<HeapEntry> buckets[65];
+	uint64_t lastKey;
+	size_t heapSize;
+	uint64_t usedBuckets; // Bit k - 1 set when bucket k is not empty
+
+	std::vector<int> pits; // Cells raised to the level being popped, flooded before the heap is touched again
+	std::vector<int> region; // Cells recomputed by update()
+	std::vector<int> seeded;
+};
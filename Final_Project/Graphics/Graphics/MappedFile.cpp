@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+	: base(NULL), length(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+{
+}
+
+bool MappedFile::open(const char* path)
+{
+	close();
+	fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mappingHandle != NULL)
+		base = (char*)MapViewOfFile(mappingHandle, FILE_MAP_COPY, 0, 0, 0);
+	if (base == NULL)
+	{
+		close();
+		return false;
+	}
+	length = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (base != NULL)
+		UnmapViewOfFile(base);
+	if (mappingHandle != NULL)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+	base = NULL;
+	length = 0;
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile()
+	: base(NULL), length(0), descriptor(-1)
+{
+}
+
+bool MappedFile::open(const char* path)
+{
+	close();
+	descriptor = ::open(path, O_RDONLY);
+	if (descriptor < 0)
+		return false;
+
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* mapped = mmap(NULL, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+	if (mapped == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+	base = (char*)mapped;
+	length = (size_t)status.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (base != NULL)
+		munmap(base, length);
+	if (descriptor >= 0)
+		::close(descriptor);
+	base = NULL;
+	length = 0;
+	descriptor = -1;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+void MappedFile::swap(MappedFile& other)
+{
+	std::swap(base, other.base);
+	std::swap(length, other.length);
+#ifdef _WIN32
+	std::swap(fileHandle, other.fileHandle);
+	std::swap(mappingHandle, other.mappingHandle);
+#else
+	std::swap(descriptor, other.descriptor);
+#endif
+}
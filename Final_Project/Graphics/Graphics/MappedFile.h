@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+
+// A whole file mapped into memory copy-on-write: the pages can be read and written in place,
+// but changes stay private to the process and never reach the file.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Map the file at path, closing any previous mapping. Returns false if it cannot be opened or mapped.
+	bool open(const char* path);
+	void close();
+
+	// Exchange the mappings of two objects
+	void swap(MappedFile& other);
+
+	bool isOpen() const { return base != NULL; }
+	char* data() const { return base; }
+	size_t size() const { return length; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	char* base;
+	size_t length;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int descriptor;
+#endif
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Number of worker threads to use when the caller does not specify one
+inline int defaultThreadCount()
+{
+	int count = (int)std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+// Run body(first, last) over [begin, end) split into contiguous blocks, one per thread.
+// The calling thread runs the body itself when one thread is enough.
+template <typename Body>
+void parallelRange(int begin, int end, int numThreads, Body body)
+{
+	int count = end - begin;
+	if (count <= 0)
+		return;
+	if (numThreads < 1)
+		numThreads = 1;
+	if (numThreads > count)
+		numThreads = count;
+	if (numThreads == 1)
+	{
+		body(begin, end);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	int blockSize = (count + numThreads - 1) / numThreads;
+	for (int first = begin; first < end; first += blockSize)
+	{
+		int last = std::min(first + blockSize, end);
+		workers.push_back(std::thread(body, first, last));
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
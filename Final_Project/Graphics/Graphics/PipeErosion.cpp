@@ -0,0 +1,350 @@
+#include "PipeErosion.h"
+#include "Simd.h"
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+
+const int LEFT = 0, RIGHT = 1, UP = 2, DOWN = 3; // Pipe directions, up and down are towards the previous and next row
+const double MIN_FLOW_DEPTH = 0.01; // Depth used for the velocity of nearly dry cells, keeps it finite
+const double MAX_COURANT = 0.5; // Sediment moves at most this many cells per step
+const double DRY_WATER_OFFSET = 0.001; // Dry cells keep their water surface just below the terrain, like initializeWaterHeight
+
+PipeSettings defaultPipeSettings()
+{
+	PipeSettings settings;
+	settings.timeStep = 0.05;
+	settings.flowRate = 0.05 * 9.81;
+	settings.rain = 0.0002;
+	settings.evaporation = 0.02;
+	settings.capacity = 0.005;
+	settings.dissolving = 0.01;
+	settings.deposition = 0.02;
+	settings.minSlope = 0.05;
+	settings.dryDepth = 0.02;
+	return settings;
+}
+
+// New outflows of a group of cells from their water surface and the surface of the four neighbours.
+// Pipes only carry water downhill, and all outflows are scaled down together when they would drain more than the cell holds.
+template <typename T, typename V>
+static void flowStep(const PipeSettings& settings, typename V::Vector terrain, typename V::Vector water,
+	const typename V::Vector neighbours[4], typename V::Vector flows[4])
+{
+	typedef typename V::Vector Vector;
+	Vector zero = V::set1(0);
+	Vector surface = V::add(terrain, water);
+	Vector rate = V::set1((T)settings.flowRate);
+	Vector total = zero;
+	for (int k = 0; k < 4; k++)
+	{
+		flows[k] = V::max(zero, V::add(flows[k], V::mul(rate, V::sub(surface, neighbours[k]))));
+		total = V::add(total, flows[k]);
+	}
+
+	Vector volume = V::mul(total, V::set1((T)settings.timeStep));
+	Vector scale = V::select(V::greaterThan(volume, water), V::div(water, V::max(volume, V::set1((T)1e-12))), V::set1(1));
+	for (int k = 0; k < 4; k++)
+		flows[k] = V::mul(flows[k], scale);
+}
+
+// Water and sediment of a group of cells after the flows have moved: the water depth changes by the net inflow,
+// the velocity follows from the flow through the cell, and the terrain is dissolved or sediment deposited until
+// the sediment approaches what water of that speed can carry down a slope of (slopeX, slopeY).
+// inflows[k] is the outflow of neighbour k towards the cell.
+template <typename T, typename V>
+static void erosionStep(const PipeSettings& settings, typename V::Vector& water, typename V::Vector& sediment,
+	const typename V::Vector outflows[4], const typename V::Vector inflows[4], typename V::Vector slopeX, typename V::Vector slopeY,
+	typename V::Vector& velocityX, typename V::Vector& velocityY, typename V::Vector& eroded)
+{
+	typedef typename V::Vector Vector;
+	Vector zero = V::set1(0);
+	Vector half = V::set1((T)0.5);
+	Vector one = V::set1(1);
+
+	Vector inflow = V::add(V::add(inflows[LEFT], inflows[RIGHT]), V::add(inflows[UP], inflows[DOWN]));
+	Vector outflow = V::add(V::add(outflows[LEFT], outflows[RIGHT]), V::add(outflows[UP], outflows[DOWN]));
+	Vector newWater = V::max(zero, V::add(water, V::mul(V::set1((T)settings.timeStep), V::sub(inflow, outflow))));
+
+	Vector depth = V::max(V::mul(V::add(water, newWater), half), V::set1((T)MIN_FLOW_DEPTH));
+	Vector maxSpeed = V::set1((T)(MAX_COURANT / settings.timeStep));
+	Vector minSpeed = V::sub(zero, maxSpeed);
+	Vector throughX = V::add(V::sub(inflows[LEFT], outflows[LEFT]), V::sub(outflows[RIGHT], inflows[RIGHT]));
+	Vector throughY = V::add(V::sub(inflows[UP], outflows[UP]), V::sub(outflows[DOWN], inflows[DOWN]));
+	velocityX = V::min(maxSpeed, V::max(minSpeed, V::div(V::mul(throughX, half), depth)));
+	velocityY = V::min(maxSpeed, V::max(minSpeed, V::div(V::mul(throughY, half), depth)));
+
+	Vector slope2 = V::add(V::mul(slopeX, slopeX), V::mul(slopeY, slopeY));
+	Vector sine = V::sqrt(V::div(slope2, V::add(one, slope2)));
+	Vector speed = V::sqrt(V::add(V::mul(velocityX, velocityX), V::mul(velocityY, velocityY)));
+	Vector capacity = V::mul(V::mul(V::set1((T)settings.capacity), V::max(sine, V::set1((T)settings.minSlope))), speed);
+
+	Vector missing = V::sub(capacity, sediment);
+	eroded = V::mul(missing, V::select(V::greaterThan(missing, zero), V::set1((T)settings.dissolving), V::set1((T)settings.deposition)));
+	sediment = V::add(sediment, eroded);
+	water = V::add(V::mul(newWater, V::set1((T)(1 - settings.evaporation))), V::set1((T)settings.rain));
+}
+
+// Sediment of a group of cells after it has moved with the water for one step, taken from the upwind neighbours
+template <typename T, typename V>
+static typename V::Vector transportStep(const PipeSettings& settings, typename V::Vector sediment,
+	const typename V::Vector neighbours[4], typename V::Vector velocityX, typename V::Vector velocityY)
+{
+	typedef typename V::Vector Vector;
+	Vector zero = V::set1(0);
+	Vector gradientX = V::select(V::greaterThan(velocityX, zero), V::sub(sediment, neighbours[LEFT]), V::sub(neighbours[RIGHT], sediment));
+	Vector gradientY = V::select(V::greaterThan(velocityY, zero), V::sub(sediment, neighbours[UP]), V::sub(neighbours[DOWN], sediment));
+	Vector change = V::add(V::mul(velocityX, gradientX), V::mul(velocityY, gradientY));
+	return V::max(zero, V::sub(sediment, V::mul(V::set1((T)settings.timeStep), change)));
+}
+
+template <typename T>
+PipeErosion<T>::PipeErosion(const PipeSettings& settings)
+	: settings(settings), current(0)
+{
+}
+
+template <typename T>
+void PipeErosion<T>::start(const Heightfield<T>& terrain, const Heightfield<T>& waterHeight)
+{
+	int height = terrain.height();
+	int width = terrain.width();
+	water.resize(height, width);
+	sediment[0].resize(height, width);
+	sediment[1].resize(height, width);
+	for (int k = 0; k < 4; k++)
+		flow[k].resize(height, width);
+	velocityX.resize(height, width);
+	velocityY.resize(height, width);
+	eroded.resize(height, width);
+	current = 0;
+
+	if (waterHeight.height() == height && waterHeight.width() == width)
+		for (int i = 0; i < height; i++)
+			for (int j = 0; j < width; j++)
+				water(i, j) = max((T)0, (T)(waterHeight(i, j) - terrain(i, j)));
+}
+
+template <typename T>
+void PipeErosion<T>::flowCell(const Heightfield<T>& terrain, int row, int col)
+{
+	typedef ScalarSimd<T> S;
+	const int offsets[4][2] = { { 0, -1 }, { 0, 1 }, { -1, 0 }, { 1, 0 } };
+	T neighbours[4], flows[4];
+	for (int k = 0; k < 4; k++)
+	{
+		int r = row + offsets[k][0], c = col + offsets[k][1];
+		// A missing neighbour has an infinitely high surface, so no water flows towards it
+		neighbours[k] = terrain.contains(r, c) ? terrain(r, c) + water(r, c) : numeric_limits<T>::infinity();
+		flows[k] = flow[k](row, col);
+	}
+	flowStep<T, S>(settings, terrain(row, col), water(row, col), neighbours, flows);
+	for (int k = 0; k < 4; k++)
+		flow[k](row, col) = flows[k];
+}
+
+template <typename T>
+void PipeErosion<T>::flowRows(const Heightfield<T>& terrain, int firstRow, int lastRow)
+{
+	typedef Simd<T> V;
+	typedef typename V::Vector Vector;
+	int height = terrain.height();
+	int width = terrain.width();
+	for (int i = firstRow; i < lastRow; i++)
+	{
+		int j = 0;
+		if (i > 0 && i < height - 1)
+		{
+			const T* b = terrain.row(i);
+			const T* d = water.row(i);
+			const T* bUp = terrain.row(i - 1);
+			const T* dUp = water.row(i - 1);
+			const T* bDown = terrain.row(i + 1);
+			const T* dDown = water.row(i + 1);
+			T* f[4] = { flow[LEFT].row(i), flow[RIGHT].row(i), flow[UP].row(i), flow[DOWN].row(i) };
+
+			flowCell(terrain, i, 0);
+			for (j = 1; j + V::LANES <= width - 1; j += V::LANES)
+			{
+				Vector neighbours[4] = {
+					V::add(V::load(b + j - 1), V::load(d + j - 1)),
+					V::add(V::load(b + j + 1), V::load(d + j + 1)),
+					V::add(V::load(bUp + j), V::load(dUp + j)),
+					V::add(V::load(bDown + j), V::load(dDown + j))
+				};
+				Vector flows[4];
+				for (int k = 0; k < 4; k++)
+					flows[k] = V::load(f[k] + j);
+				flowStep<T, V>(settings, V::load(b + j), V::load(d + j), neighbours, flows);
+				for (int k = 0; k < 4; k++)
+					V::store(f[k] + j, flows[k]);
+			}
+		}
+		for (; j < width; j++)
+			flowCell(terrain, i, j);
+	}
+}
+
+template <typename T>
+void PipeErosion<T>::erosionCell(const Heightfield<T>& terrain, int row, int col)
+{
+	typedef ScalarSimd<T> S;
+	const int offsets[4][2] = { { 0, -1 }, { 0, 1 }, { -1, 0 }, { 1, 0 } };
+	const int opposite[4] = { RIGHT, LEFT, DOWN, UP };
+	T outflows[4], inflows[4], heights[4];
+	for (int k = 0; k < 4; k++)
+	{
+		int r = row + offsets[k][0], c = col + offsets[k][1];
+		bool present = terrain.contains(r, c);
+		outflows[k] = flow[k](row, col);
+		inflows[k] = present ? flow[opposite[k]](r, c) : 0;
+		heights[k] = present ? terrain(r, c) : terrain(row, col);
+	}
+	T slopeX = (heights[RIGHT] - heights[LEFT]) / 2;
+	T slopeY = (heights[DOWN] - heights[UP]) / 2;
+
+	T waterDepth = water(row, col), load = sediment[current](row, col);
+	T speedX, speedY, amount;
+	erosionStep<T, S>(settings, waterDepth, load, outflows, inflows, slopeX, slopeY, speedX, speedY, amount);
+	water(row, col) = waterDepth;
+	sediment[current](row, col) = load;
+	velocityX(row, col) = speedX;
+	velocityY(row, col) = speedY;
+	eroded(row, col) = amount;
+}
+
+template <typename T>
+void PipeErosion<T>::erosionRows(const Heightfield<T>& terrain, int firstRow, int lastRow)
+{
+	typedef Simd<T> V;
+	typedef typename V::Vector Vector;
+	int height = terrain.height();
+	int width = terrain.width();
+	Vector half = V::set1((T)0.5);
+	for (int i = firstRow; i < lastRow; i++)
+	{
+		int j = 0;
+		if (i > 0 && i < height - 1)
+		{
+			const T* b = terrain.row(i);
+			const T* bUp = terrain.row(i - 1);
+			const T* bDown = terrain.row(i + 1);
+			T* d = water.row(i);
+			T* s = sediment[current].row(i);
+			T* vx = velocityX.row(i);
+			T* vy = velocityY.row(i);
+			T* e = eroded.row(i);
+			const T* f[4] = { flow[LEFT].row(i), flow[RIGHT].row(i), flow[UP].row(i), flow[DOWN].row(i) };
+			const T* fromUp = flow[DOWN].row(i - 1);
+			const T* fromDown = flow[UP].row(i + 1);
+
+			erosionCell(terrain, i, 0);
+			for (j = 1; j + V::LANES <= width - 1; j += V::LANES)
+			{
+				Vector outflows[4], inflows[4];
+				for (int k = 0; k < 4; k++)
+					outflows[k] = V::load(f[k] + j);
+				inflows[LEFT] = V::load(f[RIGHT] + j - 1);
+				inflows[RIGHT] = V::load(f[LEFT] + j + 1);
+				inflows[UP] = V::load(fromUp + j);
+				inflows[DOWN] = V::load(fromDown + j);
+				Vector slopeX = V::mul(V::sub(V::load(b + j + 1), V::load(b + j - 1)), half);
+				Vector slopeY = V::mul(V::sub(V::load(bDown + j), V::load(bUp + j)), half);
+
+				Vector waterDepth = V::load(d + j), load = V::load(s + j);
+				Vector speedX, speedY, amount;
+				erosionStep<T, V>(settings, waterDepth, load, outflows, inflows, slopeX, slopeY, speedX, speedY, amount);
+				V::store(d + j, waterDepth);
+				V::store(s + j, load);
+				V::store(vx + j, speedX);
+				V::store(vy + j, speedY);
+				V::store(e + j, amount);
+			}
+		}
+		for (; j < width; j++)
+			erosionCell(terrain, i, j);
+	}
+}
+
+template <typename T>
+void PipeErosion<T>::transportCell(Heightfield<T>& terrain, int row, int col)
+{
+	typedef ScalarSimd<T> S;
+	const int offsets[4][2] = { { 0, -1 }, { 0, 1 }, { -1, 0 }, { 1, 0 } };
+	const Heightfield<T>& load = sediment[current];
+	T neighbours[4];
+	for (int k = 0; k < 4; k++)
+	{
+		int r = row + offsets[k][0], c = col + offsets[k][1];
+		neighbours[k] = load.contains(r, c) ? load(r, c) : load(row, col);
+	}
+	sediment[1 - current](row, col) = transportStep<T, S>(settings, load(row, col), neighbours, velocityX(row, col), velocityY(row, col));
+	terrain(row, col) = terrain(row, col) - eroded(row, col);
+}
+
+template <typename T>
+void PipeErosion<T>::transportRows(Heightfield<T>& terrain, int firstRow, int lastRow)
+{
+	typedef Simd<T> V;
+	typedef typename V::Vector Vector;
+	int height = terrain.height();
+	int width = terrain.width();
+	for (int i = firstRow; i < lastRow; i++)
+	{
+		int j = 0;
+		if (i > 0 && i < height - 1)
+		{
+			T* b = terrain.row(i);
+			const T* s = sediment[current].row(i);
+			const T* sUp = sediment[current].row(i - 1);
+			const T* sDown = sediment[current].row(i + 1);
+			T* next = sediment[1 - current].row(i);
+			const T* vx = velocityX.row(i);
+			const T* vy = velocityY.row(i);
+			const T* e = eroded.row(i);
+
+			transportCell(terrain, i, 0);
+			for (j = 1; j + V::LANES <= width - 1; j += V::LANES)
+			{
+				Vector neighbours[4] = { V::load(s + j - 1), V::load(s + j + 1), V::load(sUp + j), V::load(sDown + j) };
+				V::store(next + j, transportStep<T, V>(settings, V::load(s + j), neighbours, V::load(vx + j), V::load(vy + j)));
+				V::store(b + j, V::sub(V::load(b + j), V::load(e + j)));
+			}
+		}
+		for (; j < width; j++)
+			transportCell(terrain, i, j);
+	}
+}
+
+template <typename T>
+void PipeErosion<T>::run(Heightfield<T>& terrain, Heightfield<T>& waterHeight, int steps, int numThreads)
+{
+	if (terrain.empty())
+		return;
+	if (water.height() != terrain.height() || water.width() != terrain.width())
+		start(terrain, waterHeight);
+
+	// Every pass only reads what the previous passes wrote, so the rows of a pass can be split freely between threads
+	for (int step = 0; step < steps; step++)
+	{
+		parallelRange(0, terrain.height(), numThreads, [this, &terrain](int firstRow, int lastRow) { flowRows(terrain, firstRow, lastRow); });
+		parallelRange(0, terrain.height(), numThreads, [this, &terrain](int firstRow, int lastRow) { erosionRows(terrain, firstRow, lastRow); });
+		parallelRange(0, terrain.height(), numThreads, [this, &terrain](int firstRow, int lastRow) { transportRows(terrain, firstRow, lastRow); });
+		current = 1 - current;
+	}
+
+	if (waterHeight.height() != terrain.height() || waterHeight.width() != terrain.width())
+		waterHeight.resize(terrain.height(), terrain.width());
+	parallelRange(0, terrain.height(), numThreads, [this, &terrain, &waterHeight](int firstRow, int lastRow)
+	{
+		for (int i = firstRow; i < lastRow; i++)
+			for (int j = 0; j < terrain.width(); j++)
+			{
+				T depth = water(i, j);
+				waterHeight(i, j) = (T)(depth > settings.dryDepth ? terrain(i, j) + depth : terrain(i, j) - DRY_WATER_OFFSET);
+			}
+	});
+}
+
+template class PipeErosion<float>;
+template class PipeErosion<double>;
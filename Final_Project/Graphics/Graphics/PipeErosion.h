@@ -0,0 +1,63 @@
+#pragma once
+#include "Heightfield.h"
+#include "Parallel.h"
+
+// Grid-based hydraulic erosion with the virtual pipe model: every cell holds a water depth and suspended sediment
+// and is connected to its four neighbours by pipes. A step moves water through the pipes along the differences of
+// the water surface, dissolves terrain where the water is fast and steep enough to carry more sediment, drops it
+// where it is not, and carries the sediment along with the water. All three passes of a step are stencils over the
+// whole grid that only read the neighbours of a cell, so rows run on separate threads and columns in SIMD lanes.
+
+// Parameters of the pipe model, amounts are per simulation step
+typedef struct {
+	double timeStep;
+	double flowRate; // Pipe cross section * gravity / pipe length, times the time step
+	double rain; // Water depth added to every cell
+	double evaporation; // Fraction of the water that evaporates
+	double capacity; // Sediment the water can carry per unit of speed and slope
+	double dissolving; // Fraction of the missing capacity taken from the terrain
+	double deposition; // Fraction of the excess sediment dropped onto the terrain
+	double minSlope; // Flat cells still carry sediment as if they were this steep
+	double dryDepth; // Cells with less water count as dry in the water layer
+} PipeSettings;
+
+PipeSettings defaultPipeSettings();
+
+// State of the pipe model between steps. The water layer is shared with the rest of the application through
+// waterHeight, the absolute height of the water surface; cells whose surface is below the terrain are dry.
+template <typename T>
+class PipeErosion {
+public:
+	PipeErosion(const PipeSettings& settings);
+
+	// Take the water depth from waterHeight and clear the sediment and flows. Call it whenever terrain or waterHeight
+	// were changed by anything else than run(), which otherwise carries on with the water of its last step.
+	void start(const Heightfield<T>& terrain, const Heightfield<T>& waterHeight);
+
+	// Run steps steps over terrain, eroding it in place, and write the resulting water surface into waterHeight.
+	// Calls start() itself on the first call and whenever the grid size changes.
+	void run(Heightfield<T>& terrain, Heightfield<T>& waterHeight, int steps, int numThreads);
+
+	// Water depth of every cell after the last step
+	const Heightfield<T>& waterDepth() const { return water; }
+
+private:
+
+	// The passes of a step over a range of rows, vectorized across the interior columns
+	void flowRows(const Heightfield<T>& terrain, int firstRow, int lastRow);
+	void erosionRows(const Heightfield<T>& terrain, int firstRow, int lastRow);
+	void transportRows(Heightfield<T>& terrain, int firstRow, int lastRow);
+
+	// The same passes for a single cell at the edges of the grid, where some neighbours are missing
+	void flowCell(const Heightfield<T>& terrain, int row, int col);
+	void erosionCell(const Heightfield<T>& terrain, int row, int col);
+	void transportCell(Heightfield<T>& terrain, int row, int col);
+
+	PipeSettings settings;
+	Heightfield<T> water;
+	Heightfield<T> sediment[2]; // Suspended sediment before and after transport, swapped every step
+	int current; // Index of the sediment of the current step
+	Heightfield<T> flow[4]; // Outflow towards the left, right, upper and lower neighbour
+	Heightfield<T> velocityX, velocityY; // Water velocity along columns and rows
+	Heightfield<T> eroded; // Terrain dissolved (or, when negative, deposited) in the current step
+};
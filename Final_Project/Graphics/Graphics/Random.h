@@ -0,0 +1,112 @@
+#pragma once
+#include <stdint.h>
+
+// Counter-based random numbers (Philox4x32-10).
+// A value is a pure function of (seed, stage, index, counter), so every stage, walker, droplet or texel
+// can draw its own numbers independently of the others and of the order in which threads run.
+
+// Independent random streams, one per generation stage
+enum RandomStage {
+	STAGE_FAULT_LINES = 1,
+	STAGE_RANDOM_WALK = 2,
+	STAGE_EROSION = 3,
+	STAGE_TEXTURE = 4,
+	STAGE_CITY_SEARCH = 5,
+	STAGE_CHUNK_FAULTS = 6,
+	STAGE_CHUNK_WALKS = 7,
+	STAGE_CHUNK_EROSION = 8,
+	STAGE_PYRAMID_REFINE = 9
+};
+
+typedef struct {
+	uint32_t v[4];
+} RandomBlock;
+
+// Multiply two 32 bit values and return the high and low halves of the result
+inline void mulHiLo32(uint32_t a, uint32_t b, uint32_t* hi, uint32_t* lo)
+{
+	uint64_t product = (uint64_t)a * b;
+	*hi = (uint32_t)(product >> 32);
+	*lo = (uint32_t)product;
+}
+
+// Ten rounds of Philox4x32 over a 128 bit counter and a 64 bit key
+inline RandomBlock philox4x32(RandomBlock counter, uint64_t key)
+{
+	uint32_t k0 = (uint32_t)key;
+	uint32_t k1 = (uint32_t)(key >> 32);
+	uint32_t hi0, lo0, hi1, lo1;
+
+	for (int round = 0; round < 10; round++)
+	{
+		mulHiLo32(0xD2511F53u, counter.v[0], &hi0, &lo0);
+		mulHiLo32(0xCD9E8D57u, counter.v[2], &hi1, &lo1);
+
+		RandomBlock next;
+		next.v[0] = hi1 ^ counter.v[1] ^ k0;
+		next.v[1] = lo1;
+		next.v[2] = hi0 ^ counter.v[3] ^ k1;
+		next.v[3] = lo0;
+		counter = next;
+
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	return counter;
+}
+
+// Four random words for one (stage, index, block) triple of a seed
+inline RandomBlock randomBlock(uint64_t seed, uint32_t stage, uint64_t index, uint32_t block)
+{
+	RandomBlock counter;
+	counter.v[0] = block;
+	counter.v[1] = stage;
+	counter.v[2] = (uint32_t)index;
+	counter.v[3] = (uint32_t)(index >> 32);
+	return philox4x32(counter, seed);
+}
+
+// Map a random word to [0, n) without the modulo bias of rand() % n
+inline int randomBelow(uint32_t word, int n)
+{
+	return (int)(((uint64_t)word * (uint32_t)n) >> 32);
+}
+
+// Sequential reader over the stream of one stage item (a walker, a droplet, a fault line...)
+class RandomStream {
+public:
+	RandomStream(uint64_t seed, uint32_t stage, uint64_t index)
+		: seed(seed), stage(stage), index(index), block(0), used(4)
+	{
+	}
+
+	uint32_t next()
+	{
+		if (used == 4)
+		{
+			current = randomBlock(seed, stage, index, block++);
+			used = 0;
+		}
+		return current.v[used++];
+	}
+
+	// Random integer in [0, n)
+	int nextInt(int n)
+	{
+		return randomBelow(next(), n);
+	}
+
+	// Random double in [0, 1)
+	double nextDouble()
+	{
+		return next() * (1.0 / 4294967296.0);
+	}
+
+private:
+	uint64_t seed;
+	uint32_t stage;
+	uint64_t index;
+	uint32_t block;
+	int used;
+	RandomBlock current;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+// Thin wrappers over SSE2 so the grid kernels can be written once for float and double storage.
+// Simd<T>::LANES values of type T are processed per operation; without SSE2 the wrappers fall back to one lane.
+
+#include <cmath>
+
+// One lane of plain arithmetic behind the same interface, used for the edges of vectorized loops
+template <typename T> struct ScalarSimd {
+	typedef T Vector;
+	static const int LANES = 1;
+
+	static Vector load(const T* p) { return *p; }
+	static void store(T* p, Vector v) { *p = v; }
+	static Vector set1(T value) { return value; }
+	static Vector ramp(T first) { return first; }
+	static Vector add(Vector a, Vector b) { return a + b; }
+	static Vector sub(Vector a, Vector b) { return a - b; }
+	static Vector mul(Vector a, Vector b) { return a * b; }
+	static Vector div(Vector a, Vector b) { return a / b; }
+	static Vector sqrt(Vector a) { return std::sqrt(a); }
+	static Vector min(Vector a, Vector b) { return b < a ? b : a; }
+	static Vector max(Vector a, Vector b) { return a < b ? b : a; }
+	// Masks are represented by the values 1 and 0
+	static Vector lessThan(Vector a, Vector b) { return a < b ? 1 : 0; }
+	static Vector greaterThan(Vector a, Vector b) { return a > b ? 1 : 0; }
+	static Vector select(Vector mask, Vector ifTrue, Vector ifFalse) { return mask != 0 ? ifTrue : ifFalse; }
+	static int maskBits(Vector mask) { return mask != 0 ? 1 : 0; }
+};
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_USE_SSE2
+#endif
+
+#ifdef TERRAIN_USE_SSE2
+
+template <typename T> struct Simd;
+
+template <> struct Simd<double> {
+	typedef __m128d Vector;
+	static const int LANES = 2;
+
+	static Vector load(const double* p) { return _mm_loadu_pd(p); }
+	static void store(double* p, Vector v) { _mm_storeu_pd(p, v); }
+	static Vector set1(double value) { return _mm_set1_pd(value); }
+	// Lane k holds first + k
+	static Vector ramp(double first) { return _mm_set_pd(first + 1, first); }
+	static Vector add(Vector a, Vector b) { return _mm_add_pd(a, b); }
+	static Vector sub(Vector a, Vector b) { return _mm_sub_pd(a, b); }
+	static Vector mul(Vector a, Vector b) { return _mm_mul_pd(a, b); }
+	static Vector div(Vector a, Vector b) { return _mm_div_pd(a, b); }
+	static Vector sqrt(Vector a) { return _mm_sqrt_pd(a); }
+	static Vector min(Vector a, Vector b) { return _mm_min_pd(a, b); }
+	static Vector max(Vector a, Vector b) { return _mm_max_pd(a, b); }
+	static Vector lessThan(Vector a, Vector b) { return _mm_cmplt_pd(a, b); }
+	static Vector greaterThan(Vector a, Vector b) { return _mm_cmpgt_pd(a, b); }
+	// Lanes of ifTrue where mask is set, lanes of ifFalse elsewhere
+	static Vector select(Vector mask, Vector ifTrue, Vector ifFalse) { return _mm_or_pd(_mm_and_pd(mask, ifTrue), _mm_andnot_pd(mask, ifFalse)); }
+	// Bit k is set when lane k of the mask is set
+	static int maskBits(Vector mask) { return _mm_movemask_pd(mask); }
+};
+
+template <> struct Simd<float> {
+	typedef __m128 Vector;
+	static const int LANES = 4;
+
+	static Vector load(const float* p) { return _mm_loadu_ps(p); }
+	static void store(float* p, Vector v) { _mm_storeu_ps(p, v); }
+	static Vector set1(float value) { return _mm_set1_ps(value); }
+	static Vector ramp(float first) { return _mm_set_ps(first + 3, first + 2, first + 1, first); }
+	static Vector add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+	static Vector sub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+	static Vector mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+	static Vector div(Vector a, Vector b) { return _mm_div_ps(a, b); }
+	static Vector sqrt(Vector a) { return _mm_sqrt_ps(a); }
+	static Vector min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+	static Vector max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+	static Vector lessThan(Vector a, Vector b) { return _mm_cmplt_ps(a, b); }
+	static Vector greaterThan(Vector a, Vector b) { return _mm_cmpgt_ps(a, b); }
+	static Vector select(Vector mask, Vector ifTrue, Vector ifFalse) { return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse)); }
+	static int maskBits(Vector mask) { return _mm_movemask_ps(mask); }
+};
+
+#else
+
+template <typename T> struct Simd : ScalarSimd<T> {};
+
+#endif
+
@@ -0,0 +1,91 @@
+#include "SinkIndex.h"
+
+using namespace std;
+
+template <typename T>
+SinkIndex<T>::SinkIndex()
+	: flow(NULL), seenRevision(0), generation(0)
+{
+}
+
+template <typename T>
+void SinkIndex<T>::attach(const FlowDirections<T>& directions)
+{
+	flow = &directions;
+	size_t cells = (size_t)directions.height() * directions.width();
+	if (parents.size() != cells)
+	{
+		parents.assign(cells, 0);
+		stamps.assign(cells, 0);
+		generation = 0;
+	}
+	// Start a generation, nothing remembered for another map is valid
+	seenRevision = directions.revision();
+	generation++;
+}
+
+template <typename T>
+int SinkIndex<T>::parent(int index)
+{
+	if (stamps[index] != generation)
+	{
+		parents[index] = flow->next(index);
+		stamps[index] = generation;
+	}
+	return parents[index];
+}
+
+template <typename T>
+int SinkIndex<T>::sink(int index)
+{
+	if (flow->revision() != seenRevision)
+	{
+		seenRevision = flow->revision();
+		generation++;
+		if (generation == 0)
+		{
+			// After 2^32 generations old stamps could match again
+			stamps.assign(stamps.size(), 0);
+			generation = 1;
+		}
+	}
+
+	// Find the root, then point every cell of the path at it
+	int root = index;
+	for (int up = parent(root); up != root; up = parent(root))
+		root = up;
+	while (index != root)
+	{
+		int up = parents[index];
+		parents[index] = root;
+		index = up;
+	}
+	return root;
+}
+
+template <typename T>
+BasinStats drainageBasins(SinkIndex<T>& index, const FlowDirections<T>& directions)
+{
+	BasinStats stats = { 0, 0, -1 };
+	int cells = directions.height() * directions.width();
+	vector<int> drained(cells, 0);
+	for (int k = 0; k < cells; k++)
+		drained[index.sink(k)]++;
+	for (int k = 0; k < cells; k++)
+	{
+		if (drained[k] == 0)
+			continue;
+		stats.basins++;
+		if (drained[k] > stats.largest)
+		{
+			stats.largest = drained[k];
+			stats.largestSink = k;
+		}
+	}
+	return stats;
+}
+
+template class SinkIndex<float>;
+template class SinkIndex<double>;
+template BasinStats drainageBasins(SinkIndex<float>& index, const FlowDirections<float>& directions);
+template BasinStats drainageBasins(SinkIndex<double>& index, const FlowDirections<double>& directions);
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "FlowDirections.h"
+
+// The local minimum every cell drains to, the cell a droplet started there ends in, without walking the whole path.
+// Cells form a forest along their flow directions and the index finds the root of a cell union-find style: every
+// cell remembers a cell further down its path, and the cells passed on a walk are pointed straight at the root, so
+// droplets sharing a path share the work and later queries take a step or two.
+// Compressed paths skip over cells, so when any direction changes no remembered cell can be trusted. Entries are
+// stamped with a generation instead of being cleared: a change of the map starts a new generation in O(1), and
+// every cell is looked up again the first time a walk reaches it afterwards.
+// The index only reads the directions, which have to outlive it; it is not safe to query from several threads.
+template <typename T>
+class SinkIndex {
+public:
+	SinkIndex();
+
+	// Answer queries for directions from now on
+	void attach(const FlowDirections<T>& directions);
+
+	// Index row * width + col of the local minimum the cell at index drains to
+	int sink(int index);
+
+	int sink(int row, int col) { return sink(row * flow->width() + col); }
+
+	// True when two cells drain to the same local minimum, i.e. lie in the same drainage basin
+	bool sameBasin(int first, int second) { return sink(first) == sink(second); }
+
+private:
+	// Cell further down the path of index, valid in the current generation
+	int parent(int index);
+
+	const FlowDirections<T>* flow;
+	uint64_t seenRevision; // Revision of the directions the current generation was started for
+	uint32_t generation;
+	std::vector<int> parents;
+	std::vector<uint32_t> stamps; // Generation every entry of parents was set in
+};
+
+// Drainage basins of a terrain after erosion
+typedef struct {
+	int basins; // Local minima, every cell drains to exactly one
+	int largest; // Cells draining to the largest basin
+	int largestSink; // Index row * width + col of its minimum
+} BasinStats;
+
+// Count the drainage basins of directions by looking up the sink of every cell
+template <typename T>
+BasinStats drainageBasins(SinkIndex<T>& index, const FlowDirections<T>& directions);
@@ -0,0 +1,118 @@
+#include "StageCache.h"
+#include "WorldFile.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+// 64 bit FNV-1a, continuing from hash
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t count)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < count; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t hashValue(uint64_t hash, uint64_t value)
+{
+	return hashBytes(hash, &value, sizeof(value));
+}
+
+StageCache::StageCache(const string& directory, uint64_t seed, int rows, int cols, HeightMap& terrain, HeightMap& waterHeight)
+	: directory(directory), terrain(terrain), waterHeight(waterHeight), pendingKey(0), pending(false), hitCount(0), missCount(0)
+{
+	key = hashValue(FNV_OFFSET_BASIS, STAGE_CACHE_VERSION);
+	key = hashValue(key, seed);
+	key = hashValue(key, (uint64_t)rows);
+	key = hashValue(key, (uint64_t)cols);
+	key = hashValue(key, sizeof(HeightValue));
+}
+
+string StageCache::entryPath(uint64_t entry) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.terrain", (unsigned long long)entry);
+	string path = directory;
+	if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\')
+		path += '/';
+	return path + name;
+}
+
+bool StageCache::load(uint64_t entry)
+{
+	return loadWorld(entryPath(entry).c_str(), mapping, terrain, waterHeight);
+}
+
+bool StageCache::run(const char* name, initializer_list<double> parameters, const function<void(HeightMap&, HeightMap&)>& stage)
+{
+	key = hashBytes(key, name, strlen(name) + 1);
+	for (initializer_list<double>::const_iterator it = parameters.begin(); it != parameters.end(); ++it)
+	{
+		double parameter = *it;
+		key = hashBytes(key, &parameter, sizeof(parameter));
+	}
+
+	if (!directory.empty())
+	{
+		// Only check that the entry exists, it is read once a later stage needs it
+		FILE* entry = fopen(entryPath(key).c_str(), "rb");
+		if (entry != NULL)
+		{
+			fclose(entry);
+			pendingKey = key;
+			pending = true;
+			skipped.push_back(stage);
+			hitCount++;
+			return false;
+		}
+	}
+
+	finish();
+	stage(terrain, waterHeight);
+	missCount++;
+	store(key);
+	return true;
+}
+
+void StageCache::store(uint64_t entry)
+{
+	if (directory.empty())
+		return;
+
+	// Write under a temporary name first so a concurrent run never sees a partial entry
+	string path = entryPath(entry);
+	string temporary = path + ".tmp";
+	if (saveWorld(temporary.c_str(), terrain, waterHeight))
+	{
+		remove(path.c_str());
+		rename(temporary.c_str(), path.c_str());
+	}
+	else
+		remove(temporary.c_str());
+}
+
+void StageCache::finish()
+{
+	if (!pending)
+		return;
+	pending = false;
+
+	// Skipping a stage changes neither the grids nor the stream counters, so if the entry turns out to be
+	// unreadable the skipped stages can simply be run now and the entry written again
+	if (!load(pendingKey))
+	{
+		for (size_t i = 0; i < skipped.size(); i++)
+			skipped[i](terrain, waterHeight);
+		hitCount -= (int)skipped.size();
+		missCount += (int)skipped.size();
+		store(pendingKey);
+	}
+	skipped.clear();
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <functional>
+#include <vector>
+#include <initializer_list>
+#include "Heightfield.h"
+#include "MappedFile.h"
+
+// On-disk cache of the terrain and water after every generation stage, addressed by content: the key of a stage is a hash
+// of its name, its parameters and the key of the stage before it, and the chain starts from the seed and grid size.
+// Stages whose output is cached are skipped without reading anything; only the output of the last stage in the
+// cached prefix is loaded, and only when a later stage has to run or the pipeline ends.
+// Entries are world files (see WorldFile.h), so they also carry the stream counters that later stages depend on.
+
+// Bump when a stage changes what it computes, so old entries are no longer found
+const uint32_t STAGE_CACHE_VERSION = 2;
+
+class StageCache {
+public:
+	// terrain and waterHeight are the grids every stage works on; terrain has to be resized to rows x cols
+	// before the first stage runs. An empty directory disables caching and runs every stage.
+	// The cache must outlive the use of the grids, which can become views into a mapped cache entry.
+	StageCache(const std::string& directory, uint64_t seed, int rows, int cols, HeightMap& terrain, HeightMap& waterHeight);
+
+	// Run a stage, or skip it when its output is already cached. Returns true if the stage was computed.
+	bool run(const char* name, std::initializer_list<double> parameters, const std::function<void(HeightMap&, HeightMap&)>& stage);
+
+	// Make the grids hold the output of the last stage, loading it from the cache if it was skipped
+	void finish();
+
+	int hits() const { return hitCount; }
+	int misses() const { return missCount; }
+
+private:
+	std::string entryPath(uint64_t key) const;
+	bool load(uint64_t key);
+	void store(uint64_t key);
+
+	std::string directory;
+	HeightMap& terrain;
+	HeightMap& waterHeight;
+	uint64_t key; // Key of the last stage run or skipped
+	uint64_t pendingKey; // Skipped stage whose output terrain does not hold yet
+	bool pending;
+	std::vector<std::function<void(HeightMap&, HeightMap&)> > skipped; // Stages skipped since the grids were last up to date
+	MappedFile mapping;
+	int hitCount, missCount;
+};
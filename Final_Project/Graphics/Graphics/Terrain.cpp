@@ -0,0 +1,419 @@
+#include "Terrain.h"
+#include "Random.h"
+#include "Simd.h"
+#include "FlowDirections.h"
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+const int FAULT_COLUMN_BLOCK = 512; // Columns per block, keeps the row segment in L1 while all faults pass over it
+const int COUNT_TILE_SIZE = 64; // Side of a tile of visit counts, tiles are only allocated where a walker goes
+
+// Fault contributions are always accumulated in double. Double rows are updated in place,
+// float rows go through a double scratch segment so each cell is rounded once per batch.
+static double* beginFaultSegment(double* row, double* scratch, int count)
+{
+	return row;
+}
+
+static double* beginFaultSegment(float* row, double* scratch, int count)
+{
+	for (int j = 0; j < count; j++)
+		scratch[j] = row[j];
+	return scratch;
+}
+
+static void endFaultSegment(double* row, const double* segment, int count)
+{
+}
+
+static void endFaultSegment(float* row, const double* segment, int count)
+{
+	for (int j = 0; j < count; j++)
+		row[j] = (float)segment[j];
+}
+
+// Add the contribution of every fault to columns [firstCol, firstCol + count) of a single row
+static void applyFaultsToRowSegment(double* segment, int rowIndex, int firstCol, int count, const vector<FaultLine>& faults)
+{
+	typedef Simd<double> V;
+	double i = rowIndex;
+	int lastCol = firstCol + count;
+
+	for (size_t f = 0; f < faults.size(); f++)
+	{
+		const FaultLine& fault = faults[f];
+		int j = firstCol;
+
+		V::Vector rowValue = V::set1(i);
+		V::Vector slope = V::set1(fault.slope);
+		V::Vector intercept = V::set1(fault.intercept);
+		V::Vector raise = V::set1(fault.delta);
+		V::Vector lower = V::set1(-fault.delta);
+		V::Vector column = V::ramp(j);
+		V::Vector step = V::set1(V::LANES);
+		for (; j + V::LANES <= lastCol; j += V::LANES)
+		{
+			// Same operations as the scalar test "i < slope * j + intercept", several columns at a time
+			V::Vector line = V::add(V::mul(slope, column), intercept);
+			V::Vector change = V::select(V::lessThan(rowValue, line), raise, lower);
+			double* cell = segment + (j - firstCol);
+			V::store(cell, V::add(V::load(cell), change));
+			column = V::add(column, step);
+		}
+
+		for (; j < lastCol; j++)
+		{
+			if (i < fault.slope * j + fault.intercept) segment[j - firstCol] += fault.delta;
+			else segment[j - firstCol] -= fault.delta;
+		}
+	}
+}
+
+template <typename T>
+void applyFaultLines(Heightfield<T>& grid, const vector<FaultLine>& faults, int numThreads)
+{
+	if (faults.empty())
+		return;
+
+	parallelRange(0, grid.height(), numThreads, [&grid, &faults](int firstRow, int lastRow)
+	{
+		double scratch[FAULT_COLUMN_BLOCK];
+		for (int i = firstRow; i < lastRow; i++)
+		{
+			T* row = grid.row(i);
+			for (int firstCol = 0; firstCol < grid.width(); firstCol += FAULT_COLUMN_BLOCK)
+			{
+				int count = min(FAULT_COLUMN_BLOCK, grid.width() - firstCol);
+				double* segment = beginFaultSegment(row + firstCol, scratch, count);
+				applyFaultsToRowSegment(segment, i, firstCol, count, faults);
+				endFaultSegment(row + firstCol, segment, count);
+			}
+		}
+	});
+}
+
+// Integer counts over a grid, stored in square tiles that are allocated on first use
+class TileCounts {
+public:
+	TileCounts(int height, int width)
+		: tilesPerRow((width + COUNT_TILE_SIZE - 1) / COUNT_TILE_SIZE),
+		tiles((size_t)tilesPerRow * ((height + COUNT_TILE_SIZE - 1) / COUNT_TILE_SIZE))
+	{
+	}
+
+	void add(int row, int col, int value)
+	{
+		vector<int>& tile = tiles[(size_t)(row / COUNT_TILE_SIZE) * tilesPerRow + col / COUNT_TILE_SIZE];
+		if (tile.empty())
+			tile.assign(COUNT_TILE_SIZE * COUNT_TILE_SIZE, 0);
+		tile[(row % COUNT_TILE_SIZE) * COUNT_TILE_SIZE + col % COUNT_TILE_SIZE] += value;
+	}
+
+	// Pointer to the counts of one tile row segment, or NULL when the tile was never touched
+	const int* tileRow(int row, int tileCol) const
+	{
+		const vector<int>& tile = tiles[(size_t)(row / COUNT_TILE_SIZE) * tilesPerRow + tileCol];
+		return tile.empty() ? NULL : &tile[(row % COUNT_TILE_SIZE) * COUNT_TILE_SIZE];
+	}
+
+	int tilesPerRow;
+
+private:
+	vector<vector<int> > tiles;
+};
+
+// Follow one walker and record +1 or -1 (the sign of its delta) on every visited cell
+static void walk(TileCounts& counts, int height, int width, const RandomWalkBatch& batch, uint64_t walker)
+{
+	RandomStream random(batch.seed, STAGE_RANDOM_WALK, walker);
+	int x = random.nextInt(width);
+	int z = random.nextInt(height);
+	int sign = random.nextInt(2) == 0 ? -1 : 1;
+
+	for (int count = 1; count <= batch.numSteps; count++)
+	{
+		counts.add(z, x, sign);
+		switch (random.nextInt(4))
+		{
+		case 0: // right
+			x++;
+			break;
+		case 1: // up
+			z++;
+			break;
+		case 2: // down
+			z--;
+			break;
+		case 3: // left
+			x--;
+			break;
+		}
+		x = (x + width) % width;
+		z = (z + height) % height;
+	}
+}
+
+template <typename T>
+void applyRandomWalks(Heightfield<T>& grid, const RandomWalkBatch& batch, int numThreads)
+{
+	int height = grid.height();
+	int width = grid.width();
+	if (batch.numWalkers <= 0 || grid.empty())
+		return;
+	if (numThreads < 1)
+		numThreads = 1;
+	if (numThreads > batch.numWalkers)
+		numThreads = batch.numWalkers;
+
+	// Every thread walks a contiguous range of walkers into its own counts
+	vector<TileCounts> counts(numThreads, TileCounts(height, width));
+	vector<thread> workers;
+	for (int t = 0; t < numThreads; t++)
+	{
+		int first = (int)((int64_t)batch.numWalkers * t / numThreads);
+		int last = (int)((int64_t)batch.numWalkers * (t + 1) / numThreads);
+		workers.push_back(thread([&counts, height, width, &batch, t, first, last]()
+		{
+			for (int k = first; k < last; k++)
+				walk(counts[t], height, width, batch, batch.firstWalker + k);
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	// Integer sums do not depend on the order of the threads, the grid is touched once per cell
+	parallelRange(0, height, numThreads, [&grid, width, &batch, &counts](int firstRow, int lastRow)
+	{
+		for (int i = firstRow; i < lastRow; i++)
+		{
+			T* row = grid.row(i);
+			for (int tileCol = 0; tileCol < counts[0].tilesPerRow; tileCol++)
+			{
+				int firstCol = tileCol * COUNT_TILE_SIZE;
+				int lastCol = min(firstCol + COUNT_TILE_SIZE, width);
+				int net[COUNT_TILE_SIZE] = { 0 };
+				bool touched = false;
+
+				for (size_t t = 0; t < counts.size(); t++)
+				{
+					const int* visits = counts[t].tileRow(i, tileCol);
+					if (visits == NULL)
+						continue;
+					touched = true;
+					for (int j = 0; j < lastCol - firstCol; j++)
+						net[j] += visits[j];
+				}
+
+				if (touched)
+					for (int j = firstCol; j < lastCol; j++)
+						row[j] = (T)(row[j] + batch.delta * net[j - firstCol]);
+			}
+		}
+	});
+}
+
+// Horizontal 1-2-1 sum of the interior columns of a row: out[j] = row[j - 1] + 2 * row[j] + row[j + 1]
+template <typename T>
+static void smoothRowHorizontal(const T* row, T* out, int width)
+{
+	typedef Simd<T> V;
+	typedef typename V::Vector Vector;
+	Vector two = V::set1(2);
+	int j = 1;
+	for (; j + V::LANES <= width - 1; j += V::LANES)
+	{
+		Vector left = V::load(row + j - 1);
+		Vector center = V::load(row + j);
+		Vector right = V::load(row + j + 1);
+		V::store(out + j, V::add(V::add(left, V::mul(two, center)), right));
+	}
+	for (; j < width - 1; j++)
+		out[j] = row[j - 1] + 2 * row[j] + row[j + 1];
+}
+
+// Vertical 1-2-1 combination of three horizontal sums, normalized by the kernel weight of 16
+template <typename T>
+static void smoothRowVertical(const T* above, const T* center, const T* below, T* out, int width)
+{
+	typedef Simd<T> V;
+	typedef typename V::Vector Vector;
+	Vector two = V::set1(2);
+	Vector weight = V::set1((T)(1 / 16.0));
+	int j = 1;
+	for (; j + V::LANES <= width - 1; j += V::LANES)
+	{
+		Vector sum = V::add(V::add(V::load(above + j), V::mul(two, V::load(center + j))), V::load(below + j));
+		V::store(out + j, V::mul(sum, weight));
+	}
+	for (; j < width - 1; j++)
+		out[j] = (above[j] + 2 * center[j] + below[j]) * (T)(1 / 16.0);
+}
+
+template <typename T>
+void smoothGrid(Heightfield<T>& grid, int passes, int numThreads)
+{
+	int width = grid.width();
+	int interiorRows = grid.height() - 2;
+	if (interiorRows <= 0 || width < 3)
+		return;
+	if (numThreads < 1)
+		numThreads = 1;
+	if (numThreads > interiorRows)
+		numThreads = interiorRows;
+
+	int blockSize = (interiorRows + numThreads - 1) / numThreads;
+	int numBlocks = (interiorRows + blockSize - 1) / blockSize;
+
+	// Horizontal sums of the rows just outside every block, taken before any block is overwritten
+	vector<T> halos((size_t)numBlocks * 2 * width);
+
+	for (int pass = 0; pass < passes; pass++)
+	{
+		for (int b = 0; b < numBlocks; b++)
+		{
+			int firstRow = 1 + b * blockSize;
+			int lastRow = min(firstRow + blockSize, grid.height() - 1);
+			smoothRowHorizontal(grid.row(firstRow - 1), &halos[(size_t)(2 * b) * width], width);
+			smoothRowHorizontal(grid.row(lastRow), &halos[(size_t)(2 * b + 1) * width], width);
+		}
+
+		vector<thread> workers;
+		for (int b = 0; b < numBlocks; b++)
+		{
+			workers.push_back(thread([&grid, width, blockSize, b, &halos]()
+			{
+				int firstRow = 1 + b * blockSize;
+				int lastRow = min(firstRow + blockSize, grid.height() - 1);
+				const T* haloAbove = &halos[(size_t)(2 * b) * width];
+				const T* haloBelow = &halos[(size_t)(2 * b + 1) * width];
+
+				// Ring of three horizontal sums, rows are overwritten only after their sum has been taken
+				vector<T> ring((size_t)3 * width);
+				T* sums[3] = { &ring[0], &ring[width], &ring[2 * (size_t)width] };
+				const T* above = haloAbove;
+				smoothRowHorizontal(grid.row(firstRow), sums[0], width);
+
+				for (int i = firstRow; i < lastRow; i++)
+				{
+					T* center = sums[(i - firstRow) % 3];
+					const T* below = haloBelow;
+					if (i + 1 < lastRow)
+					{
+						T* next = sums[(i + 1 - firstRow) % 3];
+						smoothRowHorizontal(grid.row(i + 1), next, width);
+						below = next;
+					}
+					smoothRowVertical(above, center, below, grid.row(i), width);
+					above = center;
+				}
+			}));
+		}
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+}
+
+template <typename T>
+int descendDroplet(Heightfield<T>& terrain, int row, int col, double amount)
+{
+	int steps = 0;
+	int maxSteps = terrain.height() * terrain.width();
+	uint8_t code;
+	do
+	{
+		// Same neighbour order as the original erosion loop, so ties resolve identically
+		code = FlowDirections<T>::steepestDescent(terrain, row, col);
+		terrain(row, col) = (T)(terrain(row, col) - amount);
+		steps++;
+
+		switch (code)
+		{
+		case FLOW_DOWN:
+			row++;
+			break;
+		case FLOW_RIGHT:
+			col++;
+			break;
+		case FLOW_UP:
+			row--;
+			break;
+		case FLOW_LEFT:
+			col--;
+			break;
+		}
+	} while (code != FLOW_NONE && steps < maxSteps);
+	return steps;
+}
+
+// Catmull-Rom weights of the four samples around a position t in [0, 1) between the second and third sample
+static void catmullRomWeights(double t, double weights[4])
+{
+	double t2 = t * t, t3 = t2 * t;
+	weights[0] = 0.5 * (-t3 + 2 * t2 - t);
+	weights[1] = 0.5 * (3 * t3 - 5 * t2 + 2);
+	weights[2] = 0.5 * (-3 * t3 + 4 * t2 + t);
+	weights[3] = 0.5 * (t3 - t2);
+}
+
+// The four coarse samples and their weights for one fine row or column, indices clamped to the grid
+typedef struct {
+	int index[4];
+	double weight[4];
+} SplineTaps;
+
+static SplineTaps splineTaps(int fine, int fineCount, int coarseCount)
+{
+	SplineTaps taps;
+	double position = fineCount > 1 ? fine * (coarseCount - 1) / (double)(fineCount - 1) : 0;
+	int base = min((int)position, coarseCount - 1);
+	catmullRomWeights(position - base, taps.weight);
+	for (int k = 0; k < 4; k++)
+		taps.index[k] = min(max(base - 1 + k, 0), coarseCount - 1);
+	return taps;
+}
+
+template <typename T>
+void refineGrid(const Heightfield<T>& coarse, Heightfield<T>& fine, double amplitude, uint64_t seed, uint32_t level, int numThreads)
+{
+	int coarseWidth = coarse.width();
+	vector<SplineTaps> columnTaps(fine.width());
+	for (int j = 0; j < fine.width(); j++)
+		columnTaps[j] = splineTaps(j, fine.width(), coarseWidth);
+
+	parallelRange(0, fine.height(), numThreads, [&](int firstRow, int lastRow) {
+		vector<double> column(coarseWidth); // Coarse rows interpolated vertically to the fine row
+		for (int i = firstRow; i < lastRow; i++)
+		{
+			SplineTaps rowTaps = splineTaps(i, fine.height(), coarse.height());
+			const T* rows[4];
+			for (int k = 0; k < 4; k++)
+				rows[k] = coarse.row(rowTaps.index[k]);
+			for (int c = 0; c < coarseWidth; c++)
+				column[c] = rowTaps.weight[0] * rows[0][c] + rowTaps.weight[1] * rows[1][c] +
+					rowTaps.weight[2] * rows[2][c] + rowTaps.weight[3] * rows[3][c];
+
+			RandomStream noise(seed, STAGE_PYRAMID_REFINE, ((uint64_t)level << 32) + i);
+			T* out = fine.row(i);
+			for (int j = 0; j < fine.width(); j++)
+			{
+				const SplineTaps& taps = columnTaps[j];
+				double value = taps.weight[0] * column[taps.index[0]] + taps.weight[1] * column[taps.index[1]] +
+					taps.weight[2] * column[taps.index[2]] + taps.weight[3] * column[taps.index[3]];
+				out[j] = (T)(value + (2 * noise.nextDouble() - 1) * amplitude);
+			}
+		}
+	});
+}
+
+template void applyFaultLines(Heightfield<float>& grid, const vector<FaultLine>& faults, int numThreads);
+template void applyFaultLines(Heightfield<double>& grid, const vector<FaultLine>& faults, int numThreads);
+template void applyRandomWalks(Heightfield<float>& grid, const RandomWalkBatch& batch, int numThreads);
+template void applyRandomWalks(Heightfield<double>& grid, const RandomWalkBatch& batch, int numThreads);
+template void smoothGrid(Heightfield<float>& grid, int passes, int numThreads);
+template void smoothGrid(Heightfield<double>& grid, int passes, int numThreads);
+template int descendDroplet(Heightfield<float>& terrain, int row, int col, double amount);
+template int descendDroplet(Heightfield<double>& terrain, int row, int col, double amount);
+template void refineGrid(const Heightfield<float>& coarse, Heightfield<float>& fine, double amplitude, uint64_t seed, uint32_t level, int numThreads);
+template void refineGrid(const Heightfield<double>& coarse, Heightfield<double>& fine, double amplitude, uint64_t seed, uint32_t level, int numThreads);
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Heightfield.h"
+#include "Parallel.h"
+
+// A fault line splitting the grid into two half-planes.
+// Cells with row < slope * column + intercept are raised by delta, all others are lowered by delta.
+typedef struct {
+	double slope, intercept;
+	double delta;
+} FaultLine;
+
+// Apply a batch of fault lines to a heightfield.
+// Every cell receives the contributions in the same order as applying the faults one by one,
+// so with double storage the result is bit-identical to the serial loop for any thread count.
+template <typename T>
+void applyFaultLines(Heightfield<T>& grid, const std::vector<FaultLine>& faults, int numThreads);
+
+// A batch of random walks drawn from the random walk stream of a seed.
+// Walker number firstWalker + k starts at a random cell, picks a random sign for delta and then
+// adds it to every cell it visits while stepping numSteps times in random directions (wrapping around the edges).
+typedef struct {
+	uint64_t seed;
+	uint64_t firstWalker;
+	int numWalkers;
+	int numSteps;
+	double delta;
+} RandomWalkBatch;
+
+// Run a batch of random walks over a heightfield.
+// Each thread records its walkers into private tile-local visit counts that are summed into the grid at the end,
+// so the result depends only on the seed and the batch, not on the thread count.
+template <typename T>
+void applyRandomWalks(Heightfield<T>& grid, const RandomWalkBatch& batch, int numThreads);
+
+// Smooth the interior of a heightfield with the 3x3 1-2-1 kernel, passes times.
+// The kernel is applied as a horizontal and a vertical 1-2-1 pass in place, keeping only a few scratch rows per thread.
+template <typename T>
+void smoothGrid(Heightfield<T>& grid, int passes, int numThreads);
+
+// Let one droplet run downhill from (row, col), lowering every cell it leaves by amount.
+// At each step it moves to the lowest of the four neighbours that is strictly lower, and stops in a local minimum.
+// Lowering the cell it leaves can make a droplet swing between two cells forever, so it is also stopped after
+// eroding as many cells as the grid holds. Returns the number of cells eroded.
+template <typename T>
+int descendDroplet(Heightfield<T>& terrain, int row, int col, double amount);
+
+// Resample coarse onto the already sized fine grid and add detail, one step of coarse-to-fine generation.
+// Corners of both grids line up; fine cells are interpolated with Catmull-Rom splines through the 4x4 nearest
+// coarse cells and then displaced by uniform noise in [-amplitude, amplitude]. The noise of fine row i comes
+// from stream (level << 32) + i of STAGE_PYRAMID_REFINE, so the result does not depend on the thread count.
+template <typename T>
+void refineGrid(const Heightfield<T>& coarse, Heightfield<T>& fine, double amplitude, uint64_t seed, uint32_t level, int numThreads);
@@ -0,0 +1,384 @@
+#include "TerrainChunks.h"
+#include "Terrain.h"
+#include "Random.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+const double CHUNK_PI = 3.14159265358979;
+const int EROSION_APRON = 8; // Extra cells around a chunk so droplets starting near its edge can run out of it
+
+ChunkSettings defaultChunkSettings()
+{
+	ChunkSettings settings;
+	settings.chunkSize = 64;
+	settings.faultsPerRegion = 40;
+	settings.faultRadius = 96;
+	settings.faultDelta = 0.25;
+	settings.walkersPerRegion = 10;
+	settings.walkerSteps = 400;
+	settings.walkerRange = 48;
+	settings.walkerDelta = 0.02;
+	settings.smoothPasses = 1;
+	settings.dropletsPerChunk = 2000;
+	return settings;
+}
+
+// Largest integer n with n * size <= value, also for negative values
+static int floorDiv(double value, int size)
+{
+	return (int)floor(value / size);
+}
+
+// Stream index of a region or chunk, unique for every pair of 32 bit coordinates
+static uint64_t cellIndex(int cx, int cz)
+{
+	return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cz;
+}
+
+// Grid covering world columns [originX, originX + width) and rows [originZ, originZ + height)
+typedef struct {
+	int originX, originZ;
+	HeightMap* heights;
+} WorldWindow;
+
+// Add the faults of every region whose faults can reach the window.
+// A fault raises one side of a line through a random point of its region and lowers the other side,
+// fading out smoothly at faultRadius from that point.
+static void addRegionalFaults(WorldWindow& window, uint64_t seed, const ChunkSettings& settings)
+{
+	HeightMap& heights = *window.heights;
+	int size = settings.chunkSize;
+	double radius = settings.faultRadius;
+	int firstRegionX = floorDiv(window.originX - radius, size);
+	int lastRegionX = floorDiv(window.originX + heights.width() + radius, size);
+	int firstRegionZ = floorDiv(window.originZ - radius, size);
+	int lastRegionZ = floorDiv(window.originZ + heights.height() + radius, size);
+
+	for (int rz = firstRegionZ; rz <= lastRegionZ; rz++)
+		for (int rx = firstRegionX; rx <= lastRegionX; rx++)
+		{
+			RandomStream random(seed, STAGE_CHUNK_FAULTS, cellIndex(rx, rz));
+			for (int k = 0; k < settings.faultsPerRegion; k++)
+			{
+				double centerX = (rx + random.nextDouble()) * size;
+				double centerZ = (rz + random.nextDouble()) * size;
+				double angle = random.nextDouble() * 2 * CHUNK_PI;
+				double delta = random.nextInt(2) == 0 ? -settings.faultDelta : settings.faultDelta;
+				double dirX = sin(angle), dirZ = cos(angle);
+
+				int firstCol = max(0, (int)floor(centerX - radius) - window.originX);
+				int lastCol = min(heights.width() - 1, (int)ceil(centerX + radius) - window.originX);
+				int firstRow = max(0, (int)floor(centerZ - radius) - window.originZ);
+				int lastRow = min(heights.height() - 1, (int)ceil(centerZ + radius) - window.originZ);
+
+				for (int i = firstRow; i <= lastRow; i++)
+				{
+					double dz = window.originZ + i - centerZ;
+					HeightValue* row = heights.row(i);
+					for (int j = firstCol; j <= lastCol; j++)
+					{
+						double dx = window.originX + j - centerX;
+						double fade = 1 - (dx * dx + dz * dz) / (radius * radius);
+						if (fade <= 0)
+							continue;
+						double side = dx * dirZ - dz * dirX;
+						row[j] = (HeightValue)(row[j] + (side < 0 ? delta : -delta) * fade * fade);
+					}
+				}
+			}
+		}
+}
+
+// Add the random walks of every region whose walkers can reach the window.
+// Walkers do not wrap around like in the fixed world; a step that would take a walker further than
+// walkerRange from its start is skipped, which bounds the area every region can touch.
+static void addRegionalWalks(WorldWindow& window, uint64_t seed, const ChunkSettings& settings)
+{
+	HeightMap& heights = *window.heights;
+	int size = settings.chunkSize;
+	int range = settings.walkerRange;
+	int firstRegionX = floorDiv(window.originX - range, size);
+	int lastRegionX = floorDiv(window.originX + heights.width() + range, size);
+	int firstRegionZ = floorDiv(window.originZ - range, size);
+	int lastRegionZ = floorDiv(window.originZ + heights.height() + range, size);
+
+	for (int rz = firstRegionZ; rz <= lastRegionZ; rz++)
+		for (int rx = firstRegionX; rx <= lastRegionX; rx++)
+		{
+			RandomStream random(seed, STAGE_CHUNK_WALKS, cellIndex(rx, rz));
+			for (int k = 0; k < settings.walkersPerRegion; k++)
+			{
+				int startX = rx * size + random.nextInt(size);
+				int startZ = rz * size + random.nextInt(size);
+				double delta = random.nextInt(2) == 0 ? -settings.walkerDelta : settings.walkerDelta;
+				int x = startX, z = startZ;
+
+				for (int count = 1; count <= settings.walkerSteps; count++)
+				{
+					int col = x - window.originX, row = z - window.originZ;
+					if (heights.contains(row, col))
+						heights(row, col) = (HeightValue)(heights(row, col) + delta);
+
+					int nextX = x, nextZ = z;
+					switch (random.nextInt(4))
+					{
+					case 0: // right
+						nextX++;
+						break;
+					case 1: // up
+						nextZ++;
+						break;
+					case 2: // down
+						nextZ--;
+						break;
+					case 3: // left
+						nextX--;
+						break;
+					}
+					if (abs(nextX - startX) <= range && abs(nextZ - startZ) <= range)
+					{
+						x = nextX;
+						z = nextZ;
+					}
+				}
+			}
+		}
+}
+
+// Append one quad with corners (row, col), (row - 1, col), (row - 1, col - 1), (row, col - 1) like DrawTerrain
+static void appendQuad(vector<float>& vertices, const HeightMap& heights, int originX, int originZ, int row, int col)
+{
+	const int corners[4][2] = { { row, col }, { row - 1, col }, { row - 1, col - 1 }, { row, col - 1 } };
+	for (int c = 0; c < 4; c++)
+	{
+		vertices.push_back((float)(originX + corners[c][1]));
+		vertices.push_back((float)heights(corners[c][0], corners[c][1]));
+		vertices.push_back((float)(originZ + corners[c][0]));
+	}
+}
+
+static void buildChunkMesh(TerrainChunk& chunk, int originX, int originZ)
+{
+	const HeightMap& terrain = chunk.terrain;
+	const HeightMap& water = chunk.waterHeight;
+	int size = terrain.height() - 1;
+
+	chunk.vertices.reserve((size_t)size * size * 12);
+	chunk.colors.reserve((size_t)size * size * 12);
+	for (int i = 1; i <= size; i++)
+		for (int j = 1; j <= size; j++)
+		{
+			appendQuad(chunk.vertices, terrain, originX, originZ, i, j);
+			const int corners[4][2] = { { i, j }, { i - 1, j }, { i - 1, j - 1 }, { i, j - 1 } };
+			bool wet = false;
+			for (int c = 0; c < 4; c++)
+			{
+				float color[3];
+				terrainColor(terrain(corners[c][0], corners[c][1]), color);
+				chunk.colors.insert(chunk.colors.end(), color, color + 3);
+				wet = wet || water(corners[c][0], corners[c][1]) > terrain(corners[c][0], corners[c][1]);
+			}
+			if (wet)
+				appendQuad(chunk.waterVertices, water, originX, originZ, i, j);
+		}
+}
+
+TerrainChunk* generateChunk(uint64_t seed, const ChunkSettings& settings, ChunkKey key)
+{
+	int size = settings.chunkSize;
+	int apron = settings.smoothPasses + EROSION_APRON;
+	int span = size + 1 + 2 * apron;
+
+	// Work on a window larger than the chunk so smoothing and erosion see the same neighbourhood on both sides of a border
+	HeightMap heights(span, span);
+	WorldWindow window = { key.cx * size - apron, key.cz * size - apron, &heights };
+	addRegionalFaults(window, seed, settings);
+	addRegionalWalks(window, seed, settings);
+	smoothGrid(heights, settings.smoothPasses, 1);
+
+	// Each chunk only runs its own droplets, so the border rows and columns it shares with its neighbours would come
+	// out different on both sides: they keep the heights they had before erosion
+	HeightMap uneroded = heights;
+	RandomStream random(seed, STAGE_CHUNK_EROSION, cellIndex(key.cx, key.cz));
+	for (int d = 0; d < settings.dropletsPerChunk; d++)
+	{
+		int row = apron + random.nextInt(size);
+		int col = apron + random.nextInt(size);
+		descendDroplet(heights, row, col, 0.0001);
+	}
+	for (int k = apron; k <= apron + size; k++)
+	{
+		heights(apron, k) = uneroded(apron, k);
+		heights(apron + size, k) = uneroded(apron + size, k);
+		heights(k, apron) = uneroded(k, apron);
+		heights(k, apron + size) = uneroded(k, apron + size);
+	}
+
+	TerrainChunk* chunk = new TerrainChunk;
+	chunk->key = key;
+	chunk->terrain.resize(size + 1, size + 1);
+	chunk->waterHeight.resize(size + 1, size + 1);
+	for (int i = 0; i <= size; i++)
+		for (int j = 0; j <= size; j++)
+		{
+			chunk->terrain(i, j) = heights(apron + i, apron + j);
+			chunk->waterHeight(i, j) = (HeightValue)(chunk->terrain(i, j) - 0.001);
+		}
+
+	buildChunkMesh(*chunk, key.cx * size, key.cz * size);
+	return chunk;
+}
+
+size_t chunkBytes(const TerrainChunk& chunk)
+{
+	return sizeof(TerrainChunk) + chunk.terrain.bytes() + chunk.waterHeight.bytes() +
+		(chunk.vertices.capacity() + chunk.colors.capacity() + chunk.waterVertices.capacity()) * sizeof(float);
+}
+
+void terrainColor(double height, float color[3])
+{
+	height = fabs(height) / 10.0;
+
+	if (height < 0.03) // sand
+	{
+		color[0] = 0.9f;
+		color[1] = 0.8f;
+		color[2] = 0.7f;
+	}
+	else if (height < 0.5) // grass
+	{
+		color[0] = (float)(0.2 + height / 3);
+		color[1] = (float)(0.5 - height / 2);
+		color[2] = 0;
+	}
+	else
+	{
+		color[0] = (float)(1.2 * height);
+		color[1] = (float)(1.2 * height);
+		color[2] = (float)(1.3 * height);
+	}
+}
+
+ChunkManager::ChunkManager(uint64_t seed, const ChunkSettings& settings, int viewDistance, size_t memoryBudget, int numThreads)
+	: seed(seed), settings(settings), viewDistance(viewDistance), memoryBudget(memoryBudget), bytesResident(0), stopping(false)
+{
+	if (numThreads < 1)
+		numThreads = 1;
+	for (int t = 0; t < numThreads; t++)
+		workers.push_back(thread(&ChunkManager::workerLoop, this));
+}
+
+ChunkManager::~ChunkManager()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+
+	for (map<ChunkKey, ResidentChunk>::iterator it = resident.begin(); it != resident.end(); ++it)
+		delete it->second.chunk;
+	for (size_t i = 0; i < finished.size(); i++)
+		delete finished[i];
+}
+
+void ChunkManager::workerLoop()
+{
+	for (;;)
+	{
+		ChunkKey key;
+		{
+			unique_lock<mutex> guard(lock);
+			while (!stopping && queued.empty())
+				wakeUp.wait(guard);
+			if (stopping)
+				return;
+			key = queued.front();
+			queued.pop_front();
+		}
+
+		TerrainChunk* chunk = generateChunk(seed, settings, key);
+
+		lock_guard<mutex> guard(lock);
+		finished.push_back(chunk);
+	}
+}
+
+void ChunkManager::update(double cameraX, double cameraZ)
+{
+	ChunkKey center = { floorDiv(cameraX, settings.chunkSize), floorDiv(cameraZ, settings.chunkSize) };
+
+	// Chunks within the view distance, nearest first
+	vector<pair<int, ChunkKey> > wanted;
+	for (int dz = -viewDistance; dz <= viewDistance; dz++)
+		for (int dx = -viewDistance; dx <= viewDistance; dx++)
+		{
+			ChunkKey key = { center.cx + dx, center.cz + dz };
+			wanted.push_back(make_pair(dx * dx + dz * dz, key));
+		}
+	sort(wanted.begin(), wanted.end());
+
+	{
+		lock_guard<mutex> guard(lock);
+
+		// Take over the chunks the workers have finished
+		for (size_t i = 0; i < finished.size(); i++)
+		{
+			TerrainChunk* chunk = finished[i];
+			pending.erase(chunk->key);
+			lru.push_front(chunk->key);
+			ResidentChunk entry = { chunk, lru.begin() };
+			resident[chunk->key] = entry;
+			bytesResident += chunkBytes(*chunk);
+		}
+		finished.clear();
+
+		// Requests that were not picked up yet are replaced by the current wanted set,
+		// so a camera that moves on does not leave a backlog of chunks nobody will look at
+		for (size_t i = 0; i < queued.size(); i++)
+			pending.erase(queued[i]);
+		queued.clear();
+		for (size_t i = 0; i < wanted.size(); i++)
+		{
+			const ChunkKey& key = wanted[i].second;
+			if (resident.count(key) == 0 && pending.count(key) == 0)
+			{
+				queued.push_back(key);
+				pending.insert(key);
+			}
+		}
+	}
+	wakeUp.notify_all();
+
+	// Mark the visible chunks as recently used, the rest drift to the back of the LRU list
+	visible.clear();
+	for (size_t i = 0; i < wanted.size(); i++)
+	{
+		map<ChunkKey, ResidentChunk>::iterator it = resident.find(wanted[i].second);
+		if (it == resident.end())
+			continue;
+		lru.splice(lru.begin(), lru, it->second.lruPosition);
+		visible.push_back(it->second.chunk);
+	}
+
+	evict(center);
+}
+
+void ChunkManager::evict(const ChunkKey& center)
+{
+	while (bytesResident > memoryBudget && !lru.empty())
+	{
+		ChunkKey key = lru.back();
+		if (abs(key.cx - center.cx) <= viewDistance && abs(key.cz - center.cz) <= viewDistance)
+			break; // Only visible chunks are left, the budget is smaller than the view
+		map<ChunkKey, ResidentChunk>::iterator it = resident.find(key);
+		bytesResident -= chunkBytes(*it->second.chunk);
+		delete it->second.chunk;
+		resident.erase(it);
+		lru.pop_back();
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Heightfield.h"
+
+// Streaming terrain made of fixed-size square chunks that are generated on demand around the camera.
+// Every height is a pure function of the world seed and the world position: faults and random walks are
+// emitted by regions of the world and only reach a bounded distance, so neighbouring chunks generated
+// independently (on different threads, in any order) meet without seams. Erosion is simulated per chunk,
+// so a droplet crossing a border only lowers the side it started on, and the border rows and columns a chunk shares
+// with its neighbours are left uneroded so both sides keep the same heights there.
+
+// Parameters of chunk generation, in cells
+typedef struct {
+	int chunkSize; // Cells along a chunk side
+	int faultsPerRegion; // Fault lines emitted by every region (one region per chunk)
+	double faultRadius; // Distance at which a fault has faded out completely
+	double faultDelta; // Height change at the centre of a fault
+	int walkersPerRegion; // Random walks started in every region
+	int walkerSteps;
+	int walkerRange; // Walkers are kept within this distance of their start
+	double walkerDelta;
+	int smoothPasses;
+	int dropletsPerChunk; // Erosion droplets released inside every chunk
+} ChunkSettings;
+
+ChunkSettings defaultChunkSettings();
+
+// Chunk coordinates, chunk (cx, cz) covers columns [cx * size, (cx + 1) * size) and rows [cz * size, (cz + 1) * size)
+typedef struct ChunkKey {
+	int cx, cz;
+	bool operator<(const ChunkKey& other) const { return cx != other.cx ? cx < other.cx : cz < other.cz; }
+} ChunkKey;
+
+// A generated chunk and its mesh, ready to be drawn as vertex arrays of quads
+typedef struct {
+	ChunkKey key;
+	HeightMap terrain; // (chunkSize + 1) x (chunkSize + 1) heights, the last row and column are shared with the neighbours
+	HeightMap waterHeight;
+	std::vector<float> vertices; // x, y, z of every terrain quad corner in world coordinates
+	std::vector<float> colors; // r, g, b of every terrain quad corner
+	std::vector<float> waterVertices; // x, y, z of every quad where water stands above the terrain
+} TerrainChunk;
+
+// Generate, erode and mesh one chunk
+TerrainChunk* generateChunk(uint64_t seed, const ChunkSettings& settings, ChunkKey key);
+
+// Bytes held by a chunk, counted against the memory budget
+size_t chunkBytes(const TerrainChunk& chunk);
+
+// Color of the terrain at a given height, shared by the immediate-mode renderer and the chunk meshes
+void terrainColor(double height, float color[3]);
+
+// Keeps the chunks around the camera resident. Missing chunks are generated by worker threads, nearest first;
+// chunks outside the view distance are evicted least recently used first once the memory budget is exceeded.
+class ChunkManager {
+public:
+	ChunkManager(uint64_t seed, const ChunkSettings& settings, int viewDistance, size_t memoryBudget, int numThreads);
+	~ChunkManager();
+
+	// Called once per frame from the render thread with the camera position in world coordinates
+	void update(double cameraX, double cameraZ);
+
+	// Resident chunks within the view distance of the last update
+	const std::vector<const TerrainChunk*>& visibleChunks() const { return visible; }
+
+	size_t residentBytes() const { return bytesResident; }
+	int residentCount() const { return (int)resident.size(); }
+	int chunkSize() const { return settings.chunkSize; }
+
+private:
+	typedef std::list<ChunkKey> LruList;
+	typedef struct {
+		TerrainChunk* chunk;
+		LruList::iterator lruPosition;
+	} ResidentChunk;
+
+	void workerLoop();
+	void evict(const ChunkKey& center);
+
+	uint64_t seed;
+	ChunkSettings settings;
+	int viewDistance; // In chunks around the camera chunk
+	size_t memoryBudget;
+
+	// Owned by the render thread
+	std::map<ChunkKey, ResidentChunk> resident;
+	LruList lru; // Most recently used first
+	size_t bytesResident;
+	std::vector<const TerrainChunk*> visible;
+
+	// Shared with the workers, guarded by lock
+	std::mutex lock;
+	std::condition_variable wakeUp;
+	std::deque<ChunkKey> queued; // Requests not yet picked up, nearest first
+	std::set<ChunkKey> pending; // Queued or being generated
+	std::vector<TerrainChunk*> finished;
+	bool stopping;
+
+	std::vector<std::thread> workers;
+};
@@ -0,0 +1,94 @@
+#include "TerrainClasses.h"
+#include "Parallel.h"
+#include <algorithm>
+
+using namespace std;
+
+const int PARALLEL_REFRESH_ROWS = 64; // Fewer recorded rows are classified on the calling thread
+
+TerrainClasses::TerrainClasses()
+	: terrain(NULL), waterHeight(NULL), threads(1), dirtyTop(0), dirtyBottom(-1)
+{
+}
+
+void TerrainClasses::attach(const HeightMap& terrain, const HeightMap& waterHeight, int numThreads)
+{
+	this->terrain = &terrain;
+	this->waterHeight = &waterHeight;
+	threads = max(numThreads, 1);
+	classMasks.build(terrain, waterHeight, threads);
+	classAreas.attach(classMasks);
+
+	int rows = terrain.height();
+	dirtyFirst.assign(rows, terrain.width());
+	dirtyLast.assign(rows, -1);
+	rowChanged.assign(rows, 0);
+	dirtyTop = rows;
+	dirtyBottom = -1;
+}
+
+void TerrainClasses::changed(int row, int col, int blockRows, int blockCols)
+{
+	int firstRow = max(row, 0);
+	int lastRow = min(row + blockRows, classMasks.height()) - 1;
+	int firstCol = max(col, 0);
+	int lastCol = min(col + blockCols, classMasks.width()) - 1;
+	if (firstRow > lastRow || firstCol > lastCol)
+		return;
+
+	for (int i = firstRow; i <= lastRow; i++)
+	{
+		dirtyFirst[i] = min(dirtyFirst[i], firstCol);
+		dirtyLast[i] = max(dirtyLast[i], lastCol);
+	}
+	dirtyTop = min(dirtyTop, firstRow);
+	dirtyBottom = max(dirtyBottom, lastRow);
+}
+
+void TerrainClasses::changedAll()
+{
+	changed(0, 0, classMasks.height(), classMasks.width());
+}
+
+const TerrainMasks& TerrainClasses::masks()
+{
+	refresh();
+	return classMasks;
+}
+
+AreaTables& TerrainClasses::areas()
+{
+	refresh();
+	return classAreas;
+}
+
+void TerrainClasses::refresh()
+{
+	if (dirtyTop > dirtyBottom)
+		return;
+
+	// Rows are classified independently, so bands of rows can run in parallel
+	int numThreads = dirtyBottom - dirtyTop + 1 >= PARALLEL_REFRESH_ROWS ? threads : 1;
+	parallelRange(dirtyTop, dirtyBottom + 1, numThreads, [&](int firstRow, int lastRow)
+	{
+		for (int i = firstRow; i < lastRow; i++)
+		{
+			rowChanged[i] = dirtyFirst[i] <= dirtyLast[i] &&
+				classMasks.update(*terrain, *waterHeight, i, dirtyFirst[i], 1, dirtyLast[i] - dirtyFirst[i] + 1);
+			dirtyFirst[i] = classMasks.width();
+			dirtyLast[i] = -1;
+		}
+	});
+
+	int firstChanged = dirtyTop;
+	while (firstChanged <= dirtyBottom && !rowChanged[firstChanged])
+		firstChanged++;
+	int lastChanged = dirtyBottom;
+	while (lastChanged >= firstChanged && !rowChanged[lastChanged])
+		lastChanged--;
+	if (firstChanged <= lastChanged)
+		classAreas.changed(firstChanged, lastChanged - firstChanged + 1);
+
+	dirtyTop = classMasks.height();
+	dirtyBottom = -1;
+}
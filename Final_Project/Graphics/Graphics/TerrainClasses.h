@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include "Heightfield.h"
+#include "TerrainMasks.h"
+#include "AreaTables.h"
+
+// Dry land, river and sea of the cells of a terrain and its water, kept up to date as they change. Whatever writes the
+// grids reports the cells it wrote with one of the changed() calls, which only records them, and readers get the
+// masks and area tables through masks() and areas(), which first classify again the cells recorded since the last
+// read. A city walker flattening cells every step, erosion handing back its grids or rivers being placed then all
+// cost in proportion to the cells they wrote, and no reader recomputes a class from the raw heights.
+// The cache keeps pointers to the grids, which have to outlive it and keep their size.
+class TerrainClasses {
+public:
+	TerrainClasses();
+
+	// Classify every cell of terrain and waterHeight, and use numThreads threads for large updates from now on
+	void attach(const HeightMap& terrain, const HeightMap& waterHeight, int numThreads);
+
+	bool attached() const { return terrain != NULL; }
+
+	// Cells of the grids were written: the blockRows x blockCols block at (row, col), clipped to the grid, or every
+	// cell. Nothing is recorded before attach().
+	void changed(int row, int col, int blockRows, int blockCols);
+	void changedAll();
+
+	// The classes of every cell as of now
+	const TerrainMasks& masks();
+	AreaTables& areas();
+
+private:
+	// Classify the recorded cells again and tell the area tables about the rows whose classes changed
+	void refresh();
+
+	const HeightMap* terrain;
+	const HeightMap* waterHeight;
+	int threads;
+	TerrainMasks classMasks;
+	AreaTables classAreas;
+
+	// Columns dirtyFirst[i] to dirtyLast[i] of row i were written since the last refresh, none when first > last.
+	// Rows dirtyTop to dirtyBottom hold every recorded column.
+	std::vector<int> dirtyFirst, dirtyLast;
+	int dirtyTop, dirtyBottom;
+	std::vector<uint8_t> rowChanged; // Scratch of refresh(), a class of the row changed
+};
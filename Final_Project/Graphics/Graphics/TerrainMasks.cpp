@@ -0,0 +1,84 @@
+#include "TerrainMasks.h"
+#include "Simd.h"
+#include "Parallel.h"
+#include <algorithm>
+
+using namespace std;
+
+TerrainMasks::TerrainMasks()
+	: rows(0), cols(0), rowWords(0)
+{
+}
+
+void TerrainMasks::build(const HeightMap& terrain, const HeightMap& waterHeight, int numThreads)
+{
+	rows = terrain.height();
+	cols = terrain.width();
+	rowWords = (cols + 63) / 64;
+	for (int p = 0; p < MASK_PLANES; p++)
+		planes[p].assign((size_t)(rows + 2 * MASK_PADDING) * (rowWords + 2), 0);
+
+	parallelRange(0, rows, numThreads, [&](int firstRow, int lastRow)
+	{
+		for (int i = firstRow; i < lastRow; i++)
+			classify(terrain, waterHeight, i, 0, rowWords);
+	});
+}
+
+bool TerrainMasks::update(const HeightMap& terrain, const HeightMap& waterHeight, int row, int col, int blockRows, int blockCols)
+{
+	int firstRow = max(row, 0);
+	int lastRow = min(row + blockRows, rows);
+	int firstCol = max(col, 0);
+	int lastCol = min(col + blockCols, cols);
+	bool changed = false;
+	for (int i = firstRow; i < lastRow && firstCol < lastCol; i++)
+		changed |= classify(terrain, waterHeight, i, firstCol / 64, (lastCol + 63) / 64);
+	return changed;
+}
+
+// Same comparisons as isAboveWater, isUnderRiverLevel and isUnderSeaLevel, several cells per SIMD compare
+bool TerrainMasks::classify(const HeightMap& terrain, const HeightMap& waterHeight, int row, int firstWord, int lastWord)
+{
+	typedef Simd<HeightValue> V;
+	typedef V::Vector Vector;
+	const HeightValue* heights = terrain.row(row);
+	const HeightValue* water = waterHeight.row(row);
+	uint64_t* dry = planeRow(MASK_DRY, row);
+	uint64_t* river = planeRow(MASK_RIVER, row);
+	uint64_t* sea = planeRow(MASK_SEA, row);
+	Vector zero = V::set1(0);
+	bool changed = false;
+
+	for (int w = firstWord; w < lastWord; w++)
+	{
+		int first = w * 64;
+		int last = min(first + 64, cols);
+		uint64_t dryBits = 0, riverBits = 0, seaBits = 0;
+		int j = first;
+		for (; j + V::LANES <= last; j += V::LANES)
+		{
+			Vector t = V::load(heights + j);
+			Vector h = V::load(water + j);
+			int shift = j - first;
+			dryBits |= (uint64_t)(V::maskBits(V::greaterThan(t, zero)) & V::maskBits(V::greaterThan(t, h))) << shift;
+			riverBits |= (uint64_t)(V::maskBits(V::greaterThan(h, zero)) & V::maskBits(V::lessThan(t, h))) << shift;
+			seaBits |= (uint64_t)(V::maskBits(V::lessThan(t, zero)) & V::maskBits(V::lessThan(h, zero))) << shift;
+		}
+		for (; j < last; j++)
+		{
+			uint64_t bit = (uint64_t)1 << (j - first);
+			if (heights[j] > 0 && heights[j] > water[j])
+				dryBits |= bit;
+			if (water[j] > 0 && heights[j] < water[j])
+				riverBits |= bit;
+			if (heights[j] < 0 && water[j] < 0)
+				seaBits |= bit;
+		}
+		changed |= dry[w] != dryBits || river[w] != riverBits || sea[w] != seaBits;
+		dry[w] = dryBits;
+		river[w] = riverBits;
+		sea[w] = seaBits;
+	}
+	return changed;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Heightfield.h"
+
+// The three classes of a cell the city code tests for, each kept as a bitboard
+enum MaskPlane {
+	MASK_DRY, // isAboveWater
+	MASK_RIVER, // isUnderRiverLevel
+	MASK_SEA // isUnderSeaLevel
+};
+
+const int MASK_PLANES = 3;
+const int MASK_PADDING = 4; // Rows of empty cells above and below the grid, template tests may reach that far out
+
+// Dry land, river and sea of every cell as bitboards, 64 cells of a row per word with column col in bit col % 64 of
+// word col / 64. Rows are padded with an empty word on both sides and the grid with MASK_PADDING empty rows, so a
+// test near the edge reads empty cells instead of checking bounds, like the isAboveWater family returns false
+// outside the grid. A test of a row of cells then costs a shift and a mask instead of a call per cell.
+class TerrainMasks {
+public:
+	TerrainMasks();
+
+	// Classify every cell of terrain and waterHeight
+	void build(const HeightMap& terrain, const HeightMap& waterHeight, int numThreads);
+
+	// Classify the cells of the blockRows x blockCols block at (row, col) again after terrain or waterHeight
+	// changed there. The block is clipped to the grid. Returns true when the class of any cell changed.
+	bool update(const HeightMap& terrain, const HeightMap& waterHeight, int row, int col, int blockRows, int blockCols);
+
+	bool dry(int row, int col) const { return (bits(MASK_DRY, row, col) & 1) != 0; }
+	bool river(int row, int col) const { return (bits(MASK_RIVER, row, col) & 1) != 0; }
+	bool sea(int row, int col) const { return (bits(MASK_SEA, row, col) & 1) != 0; }
+
+	// The 64 cells of a plane from (row, col) on in bits 0 to 63. Columns from -64 to the width and rows up to
+	// MASK_PADDING outside the grid can be read and are empty.
+	uint64_t bits(MaskPlane plane, int row, int col) const
+	{
+		const uint64_t* words = planeRow(plane, row);
+		int word = (col + 64) / 64 - 1; // Rounds down for negative columns too
+		int shift = col - word * 64;
+		uint64_t low = words[word] >> shift;
+		return shift == 0 ? low : low | words[word + 1] << (64 - shift);
+	}
+
+	int height() const { return rows; }
+	int width() const { return cols; }
+
+	// Words of a row of the bitboards
+	int words() const { return rowWords; }
+
+private:
+	const uint64_t* planeRow(MaskPlane plane, int row) const
+	{
+		return &planes[plane][(size_t)(row + MASK_PADDING) * (rowWords + 2) + 1];
+	}
+
+	uint64_t* planeRow(MaskPlane plane, int row)
+	{
+		return &planes[plane][(size_t)(row + MASK_PADDING) * (rowWords + 2) + 1];
+	}
+
+	// Classify the cells of words firstWord to lastWord - 1 of a row, true when any class changed
+	bool classify(const HeightMap& terrain, const HeightMap& waterHeight, int row, int firstWord, int lastWord);
+
+	std::vector<uint64_t> planes[MASK_PLANES];
+	int rows, cols;
+	int rowWords;
+};
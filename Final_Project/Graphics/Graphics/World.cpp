@@ -0,0 +1,253 @@
+#include "World.h"
+#include "Random.h"
+#include "PipeErosion.h"
+#include "FlowAccumulation.h"
+#include "LakeFill.h"
+#include "CitySites.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+const int PYRAMID_DETAIL_LEVELS = 8; // At most this many refinement levels in pyramid mode
+const double PYRAMID_DETAIL = 0.01; // Noise added when refining to the finest level, doubled for every coarser level
+const int EROSION_ROUND_CELLS = 64; // Grid cells per droplet of an erosion round, keeps the droplets of a round mostly apart
+const double EROSION_AMOUNT = 0.0001; // Height a droplet takes from every cell it passes
+const int RIVER_SOURCE_CELLS = 25; // Cells that must drain through a cell of the default grid for a river to start there
+const double RIVER_DEPTH = 0.01; // Depth of a river at its source, growing with the square root of the cells drained
+
+
+uint64_t worldSeed = 0;
+uint64_t faultCount = 0;
+uint64_t walkerCount = 0;
+uint64_t dropletCount = 0;
+uint64_t citySearchCount = 0;
+
+Point2D cityLocation = { -100, -100 };
+
+bool cityExpandRight = false;
+bool cityExpandLeft = false;
+bool cityExpandUp = false;
+bool cityExpandDown = false;
+
+// Initialize water height slightly below the terrain height
+void initializeWaterHeight(const HeightMap& terrain, HeightMap& waterHeight) {
+	waterHeight.resize(terrain.height(), terrain.width());
+	for (int i = 0; i < terrain.height(); i++) {
+		for (int j = 0; j < terrain.width(); j++) {
+			waterHeight(i, j) = terrain(i, j) - 0.001;
+		}
+	}
+}
+
+// Draw fault line number faultIndex, returns false for a vertical line which leaves the terrain unchanged
+static bool randomFaultLine(uint64_t faultIndex, int width, int height, FaultLine* fault)
+{
+	RandomStream random(worldSeed, STAGE_FAULT_LINES, faultIndex);
+	int x1, z1, x2, z2;
+	double delta = 0.05;
+
+	if (random.nextInt(2) == 0)
+		delta = -delta;
+
+	x1 = random.nextInt(width);
+	z1 = random.nextInt(height);
+
+	x2 = random.nextInt(width);
+	z2 = random.nextInt(height);
+
+	if (x1 == x2)
+		return false;
+
+	fault->slope = (z2 - z1) / ((double)(x2 - x1));
+	fault->intercept = z1 - fault->slope * x1;
+	fault->delta = delta;
+	return true;
+}
+
+// Modify the terrain with a linear erosion model.
+// All fault lines are drawn first and then applied in one pass over the grid.
+void UpdateTerrainMethod2(HeightMap& terrain, int numFaults)
+{
+	vector<FaultLine> faults;
+	FaultLine fault;
+
+	faults.reserve(numFaults);
+	for (int i = 0; i < numFaults; i++)
+		if (randomFaultLine(faultCount++, terrain.width(), terrain.height(), &fault))
+			faults.push_back(fault);
+
+	applyFaultLines(terrain, faults, defaultThreadCount());
+}
+
+// Checks if a position is underwater (for sea level)
+bool isUnderSeaLevel(const HeightMap& terrain, const HeightMap& waterHeight, int x, int z) {
+	return terrain.contains(x, z) && 0 > terrain(x, z) && 0 > waterHeight(x, z);
+}
+
+// Checks if a position is underwater (for river level)
+bool isUnderRiverLevel(const HeightMap& terrain, const HeightMap& waterHeight, int x, int z) {
+	return terrain.contains(x, z) && 0 < waterHeight(x, z) && terrain(x, z) < waterHeight(x, z);
+}
+
+// Checks if the point is above water (both sea and river)
+bool isAboveWater(const HeightMap& terrain, const HeightMap& waterHeight, int x, int z) {
+	return terrain.contains(x, z) && terrain(x, z) > 0 && terrain(x, z) > waterHeight(x, z);
+}
+
+// Droplets of an erosion round on terrain
+static int erosionRoundSize(const HeightMap& terrain) {
+	return max(1, terrain.height() * terrain.width() / EROSION_ROUND_CELLS);
+}
+
+// Hydraulic erosion simulation, releases the next numDroplets droplets of the erosion stream in parallel
+ErosionStats hydraulicErosion(HeightMap& terrain, int numDroplets, DropletErosion<HeightValue>* erosion) {
+	DropletBatch batch;
+	batch.seed = worldSeed;
+	batch.firstDroplet = dropletCount;
+	batch.numDroplets = numDroplets;
+	batch.roundSize = erosionRoundSize(terrain);
+	batch.amount = EROSION_AMOUNT;
+	dropletCount += numDroplets;
+
+	if (erosion != NULL)
+		return erosion->run(terrain, batch, defaultThreadCount());
+
+	// Nothing keeps an open round for the next call, the last droplets are applied now
+	DropletErosion<HeightValue> ownErosion;
+	ErosionStats stats = ownErosion.run(terrain, batch, defaultThreadCount());
+	ownErosion.finishRound(terrain, defaultThreadCount());
+	return stats;
+}
+
+ErosionStats completeErosionRound(HeightMap& terrain, DropletErosion<HeightValue>& erosion) {
+	ErosionStats stats = { 0, 0, 0 };
+	if (!erosion.roundPending())
+		return stats;
+	int roundSize = erosionRoundSize(terrain);
+	return hydraulicErosion(terrain, (int)(roundSize - dropletCount % roundSize), &erosion);
+}
+
+// Grid-based erosion with the pipe model, runs steps steps and writes the water it leaves into waterHeight
+void pipeErosion(HeightMap& terrain, HeightMap& waterHeight, int steps, PipeErosion<HeightValue>* model) {
+	if (model != NULL)
+	{
+		model->run(terrain, waterHeight, steps, defaultThreadCount());
+		return;
+	}
+	PipeErosion<HeightValue> ownModel(defaultPipeSettings());
+	ownModel.run(terrain, waterHeight, steps, defaultThreadCount());
+}
+
+// Rivers from flow accumulation. Drainage area in cells grows with the grid side along a river, so the source
+// threshold is scaled from the default grid. Rivers are only placed on land and never lower existing water.
+int placeRivers(const HeightMap& terrain, HeightMap& waterHeight) {
+	int numThreads = defaultThreadCount();
+	FlowDirections<HeightValue> directions;
+	directions.build(terrain, numThreads);
+	SinkIndex<HeightValue> sinks;
+	sinks.attach(directions);
+	vector<int> drained;
+	accumulateFlow(directions, sinks, drained, numThreads);
+
+	int width = terrain.width();
+	int source = max(2, RIVER_SOURCE_CELLS * width / DEFAULT_GRID_SIZE);
+	int riverCells = 0;
+	for (int i = 0; i < terrain.height(); i++) {
+		for (int j = 0; j < width; j++) {
+			int cells = drained[i * width + j];
+			if (cells < source || terrain(i, j) <= 0)
+				continue;
+			HeightValue surface = (HeightValue)(terrain(i, j) + RIVER_DEPTH * sqrt((double)cells / source));
+			waterHeight(i, j) = max(waterHeight(i, j), surface);
+			riverCells++;
+		}
+	}
+	return riverCells;
+}
+
+// Lakes by priority-flood from the sea and the edges of the grid, sea level is 0 as in isUnderSeaLevel
+int fillLakes(const HeightMap& terrain, HeightMap& waterHeight) {
+	LakeFill<HeightValue> lakes;
+	lakes.build(terrain, 0);
+	return lakes.writeLakes(waterHeight);
+}
+
+// Random walk terrain modification, runs numWalkers walks of numSteps steps each in parallel
+void UpdateTerrainMethod3(HeightMap& terrain, int numWalkers, int numSteps)
+{
+	RandomWalkBatch batch;
+	batch.seed = worldSeed;
+	batch.firstWalker = walkerCount;
+	batch.numWalkers = numWalkers;
+	batch.numSteps = numSteps;
+	batch.delta = 0.02;
+	walkerCount += numWalkers;
+
+	applyRandomWalks(terrain, batch, defaultThreadCount());
+}
+
+// Apply a smoothing filter to the terrain, passes times
+void SmoothTerrain(HeightMap& terrain, int passes)
+{
+	smoothGrid(terrain, passes, defaultThreadCount());
+}
+
+// Generate a large terrain coarse to fine. The usual stages run on a grid of the default size, whose
+// resolution is then raised by a factor of at most two per level until it reaches the requested size.
+// Each level interpolates the coarser grid and adds noise that gets finer and weaker with every level,
+// instead of paying for every fault and walker step at full resolution.
+void generateTerrainPyramid(HeightMap& terrain, int size)
+{
+	int levels = min((int)ceil(log((double)size / DEFAULT_GRID_SIZE) / log(2.0)), PYRAMID_DETAIL_LEVELS);
+	vector<int> sizes; // Grid size of every level, finest first, growing by the same factor on every level
+	for (int level = 0; level <= levels; level++)
+		sizes.push_back((int)floor(DEFAULT_GRID_SIZE * pow((double)size / DEFAULT_GRID_SIZE, (levels - level) / (double)levels) + 0.5));
+
+	HeightMap coarse(DEFAULT_GRID_SIZE, DEFAULT_GRID_SIZE);
+	UpdateTerrainMethod2(coarse, 4000);
+	UpdateTerrainMethod3(coarse, 500, 800);
+	SmoothTerrain(coarse, 1);
+	UpdateTerrainMethod3(coarse, 15, 800);
+
+	for (int level = levels - 1; level >= 0; level--)
+	{
+		HeightMap fine(sizes[level], sizes[level]);
+		refineGrid(coarse, fine, PYRAMID_DETAIL * (1 << level), worldSeed, level, defaultThreadCount());
+		coarse = fine;
+	}
+	terrain = coarse;
+}
+
+// Set cityLocation and the expansion direction to a site
+static void foundCity(const CitySite& site)
+{
+	cityLocation.x = site.x;
+	cityLocation.z = site.z;
+	cityExpandRight = site.direction == CITY_RIGHT;
+	cityExpandLeft = site.direction == CITY_LEFT;
+	cityExpandUp = site.direction == CITY_UP;
+	cityExpandDown = site.direction == CITY_DOWN;
+}
+
+// Scan for every city site and pick one with the next draw of the city search stream
+int searchCitySite(const TerrainMasks& masks)
+{
+	vector<CitySite> sites = scanCitySites(masks, defaultThreadCount());
+	if (!sites.empty())
+	{
+		RandomStream random(worldSeed, STAGE_CITY_SEARCH, citySearchCount++);
+		foundCity(sites[random.nextInt((int)sites.size())]);
+	}
+	return (int)sites.size();
+}
+
+// Rank every city site and pick the first
+vector<RankedSite> searchBestCitySite(const TerrainMasks& masks, AreaTables& areas, int count)
+{
+	vector<RankedSite> best = rankCitySites(masks, areas, max(count, 1), defaultThreadCount());
+	if (!best.empty())
+		foundCity(best[0].site);
+	return best;
+}
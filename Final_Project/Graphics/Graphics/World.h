@@ -0,0 +1,87 @@
+#pragma once
+#include <stdint.h>
+#include "Terrain.h"
+#include "DropletErosion.h"
+#include "PipeErosion.h"
+#include "Heightfield.h"
+#include "TerrainMasks.h"
+#include "CitySites.h"
+
+// The generation pipeline of the fixed-size world without any OpenGL, shared by the viewer and the headless tool.
+// Every stage draws from the random streams of worldSeed and advances its own counter, so running the same
+// stages in the same order with the same seed reproduces the same world.
+
+const int DEFAULT_GRID_SIZE = 100; // Grid size for terrain when none is given on the command line
+
+// Structure for representing 2D points (used for terrain and city building)
+typedef struct {
+	int x;
+	int z;
+} Point2D;
+
+extern uint64_t worldSeed; // Seed of every random stream, the same seed reproduces the whole world
+extern uint64_t faultCount; // Number of fault lines drawn so far, indexes the fault line stream
+extern uint64_t walkerCount; // Number of random walks drawn so far, indexes the random walk stream
+extern uint64_t dropletCount; // Number of erosion droplets released so far, indexes the erosion stream
+extern uint64_t citySearchCount; // Number of city site searches so far, indexes the city search stream
+
+extern Point2D cityLocation; // Stores city position, x is -100 until a site is found
+
+// Direction in which the city grows from cityLocation, set together with it
+extern bool cityExpandRight;
+extern bool cityExpandLeft;
+extern bool cityExpandUp;
+extern bool cityExpandDown;
+
+// Modify the terrain with a linear erosion model
+void UpdateTerrainMethod2(HeightMap& terrain, int numFaults);
+
+// Random walk terrain modification
+void UpdateTerrainMethod3(HeightMap& terrain, int numWalkers, int numSteps);
+
+// Apply a smoothing filter to the terrain, passes times
+void SmoothTerrain(HeightMap& terrain, int passes);
+
+// Generate a terrain larger than the default size coarse to fine
+void generateTerrainPyramid(HeightMap& terrain, int size);
+
+// Initialize water height slightly below the terrain height
+void initializeWaterHeight(const HeightMap& terrain, HeightMap& waterHeight);
+
+// Release the next numDroplets erosion droplets. Callers eroding the same terrain repeatedly pass an engine that
+// keeps its flow directions between calls, instead of having them built on every call. Droplets are addressed by
+// their index in the erosion stream, so droplets 0 to n - 1 give the same terrain whether they run in one call or
+// many. With an engine the last round can stay open; completeErosionRound() closes it.
+ErosionStats hydraulicErosion(HeightMap& terrain, int numDroplets, DropletErosion<HeightValue>* erosion = NULL);
+
+// Release the droplets up to the end of the round erosion has open, so the terrain is at a round boundary and
+// eroding on from it (after saving and loading, say) gives the same terrain as one uninterrupted run
+ErosionStats completeErosionRound(HeightMap& terrain, DropletErosion<HeightValue>& erosion);
+
+// Run steps steps of pipe model erosion, the alternative to droplets that also moves the water layer. Callers eroding
+// the same grids repeatedly pass a model that keeps its water, sediment and flows between calls; without one the
+// water is taken from waterHeight and everything else starts from zero.
+void pipeErosion(HeightMap& terrain, HeightMap& waterHeight, int steps, PipeErosion<HeightValue>* model = NULL);
+
+// Place rivers where the flow accumulated over the terrain is large enough and write them into waterHeight: the
+// surface of a river cell lies above the terrain by a depth that grows with the cells draining through it.
+// Returns the number of river cells.
+int placeRivers(const HeightMap& terrain, HeightMap& waterHeight);
+
+// Fill every depression of the terrain up to the level it spills over at and write the lakes into waterHeight.
+// Returns the number of lake cells.
+int fillLakes(const HeightMap& terrain, HeightMap& waterHeight);
+
+// Classify a cell, false outside the grid
+bool isUnderSeaLevel(const HeightMap& terrain, const HeightMap& waterHeight, int x, int z);
+bool isUnderRiverLevel(const HeightMap& terrain, const HeightMap& waterHeight, int x, int z);
+bool isAboveWater(const HeightMap& terrain, const HeightMap& waterHeight, int x, int z);
+
+// Scan the whole grid for city sites in one pass over the class bitboards of terrain and water, and found the city at
+// one of them, drawn from the city search stream: sets cityLocation and the expansion direction. Returns the number
+// of sites, 0 when there is none.
+int searchCitySite(const TerrainMasks& masks);
+
+// Score every city site of the grid and found the city at the best one, the same site for the same world whatever
+// the seed stream has drawn so far. Returns the count best sites, best first, empty when there is none.
+std::vector<RankedSite> searchBestCitySite(const TerrainMasks& masks, AreaTables& areas, int count);
@@ -0,0 +1,167 @@
+#include "WorldFile.h"
+#include "World.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+static uint64_t alignSection(uint64_t offset)
+{
+	return (offset + WORLD_SECTION_ALIGNMENT - 1) / WORLD_SECTION_ALIGNMENT * WORLD_SECTION_ALIGNMENT;
+}
+
+static CityDirection currentCityDirection()
+{
+	if (cityExpandRight)
+		return CITY_RIGHT;
+	if (cityExpandLeft)
+		return CITY_LEFT;
+	if (cityExpandUp)
+		return CITY_UP;
+	if (cityExpandDown)
+		return CITY_DOWN;
+	return CITY_NONE;
+}
+
+static bool writePadding(FILE* file, uint64_t from, uint64_t to)
+{
+	static const char zeros[WORLD_SECTION_ALIGNMENT] = { 0 };
+	return fwrite(zeros, 1, (size_t)(to - from), file) == to - from;
+}
+
+bool saveWorld(const char* path, const HeightMap& terrain, const HeightMap& waterHeight)
+{
+	bool hasWater = !waterHeight.empty();
+	if (hasWater && (terrain.height() != waterHeight.height() || terrain.width() != waterHeight.width() || terrain.stride() != waterHeight.stride()))
+		return false;
+
+	WorldFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, WORLD_FILE_MAGIC, sizeof(header.magic));
+	header.version = WORLD_FILE_VERSION;
+	header.byteOrder = WORLD_BYTE_ORDER;
+	header.headerSize = sizeof(WorldFileHeader);
+	header.valueSize = sizeof(HeightValue);
+	header.rows = terrain.height();
+	header.cols = terrain.width();
+	header.stride = terrain.stride();
+	header.seed = worldSeed;
+	header.faultCount = faultCount;
+	header.walkerCount = walkerCount;
+	header.dropletCount = dropletCount;
+	header.citySearchCount = citySearchCount;
+	header.cityX = cityLocation.x;
+	header.cityZ = cityLocation.z;
+	header.cityDirection = currentCityDirection();
+
+	const HeightMap* grids[WORLD_SECTION_COUNT] = { &terrain, &waterHeight };
+	uint64_t offset = sizeof(WorldFileHeader);
+	for (int s = 0; s < WORLD_SECTION_COUNT; s++)
+	{
+		header.sections[s].offset = alignSection(offset);
+		header.sections[s].bytes = grids[s]->bytes();
+		offset = header.sections[s].offset + header.sections[s].bytes;
+	}
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	offset = sizeof(WorldFileHeader);
+	for (int s = 0; s < WORLD_SECTION_COUNT && ok; s++)
+	{
+		ok = writePadding(file, offset, header.sections[s].offset);
+		if (ok && header.sections[s].bytes > 0)
+			ok = fwrite(grids[s]->row(0), 1, (size_t)header.sections[s].bytes, file) == header.sections[s].bytes;
+		offset = header.sections[s].offset + header.sections[s].bytes;
+	}
+	return fclose(file) == 0 && ok;
+}
+
+// Check that the header describes grids that lie completely inside a file of the given size
+static bool validHeader(const WorldFileHeader& header, size_t fileSize)
+{
+	if (memcmp(header.magic, WORLD_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != WORLD_FILE_VERSION ||
+		header.byteOrder != WORLD_BYTE_ORDER || header.headerSize != sizeof(WorldFileHeader))
+		return false;
+	if (header.valueSize != sizeof(float) && header.valueSize != sizeof(double))
+		return false;
+	if (header.rows <= 0 || header.cols <= 0 || header.stride < header.cols)
+		return false;
+
+	uint64_t gridBytes = (uint64_t)header.rows * header.stride * header.valueSize;
+	for (int s = 0; s < WORLD_SECTION_COUNT; s++)
+	{
+		const WorldSection& section = header.sections[s];
+		bool missingWater = s == WORLD_SECTION_WATER && section.bytes == 0;
+		if ((section.bytes != gridBytes && !missingWater) || section.offset % HEIGHTFIELD_ALIGNMENT != 0 ||
+			section.offset < sizeof(WorldFileHeader) || section.offset > fileSize || section.bytes > fileSize - section.offset)
+			return false;
+	}
+	return true;
+}
+
+// Copy a grid stored with the other height type into an owned grid
+template <typename Stored>
+static void convertSection(const char* data, const WorldFileHeader& header, HeightMap& grid)
+{
+	grid.resize(header.rows, header.cols);
+	const Stored* cells = (const Stored*)data;
+	for (int i = 0; i < header.rows; i++)
+	{
+		HeightValue* row = grid.row(i);
+		for (int j = 0; j < header.cols; j++)
+			row[j] = (HeightValue)cells[(size_t)i * header.stride + j];
+	}
+}
+
+bool loadWorld(const char* path, MappedFile& mapping, HeightMap& terrain, HeightMap& waterHeight)
+{
+	MappedFile file;
+	if (!file.open(path) || file.size() < sizeof(WorldFileHeader))
+		return false;
+
+	WorldFileHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (!validHeader(header, file.size()))
+		return false;
+
+	// A city has to lie on the grid, the city builder reads the cells around it without further checks
+	bool noCity = header.cityX == -100 && header.cityDirection == CITY_NONE;
+	bool validCity = header.cityDirection > CITY_NONE && header.cityDirection <= CITY_DOWN &&
+		header.cityX >= 0 && header.cityX < header.rows && header.cityZ >= 0 && header.cityZ < header.cols;
+	if (!noCity && !validCity)
+		return false;
+
+	HeightMap* grids[WORLD_SECTION_COUNT] = { &terrain, &waterHeight };
+	for (int s = 0; s < WORLD_SECTION_COUNT; s++)
+	{
+		char* data = file.data() + header.sections[s].offset;
+		if (header.sections[s].bytes == 0)
+			grids[s]->resize(0, 0);
+		else if (header.valueSize == sizeof(HeightValue))
+			grids[s]->wrap((HeightValue*)data, header.rows, header.cols, header.stride);
+		else if (header.valueSize == sizeof(float))
+			convertSection<float>(data, header, *grids[s]);
+		else
+			convertSection<double>(data, header, *grids[s]);
+	}
+
+	worldSeed = header.seed;
+	faultCount = header.faultCount;
+	walkerCount = header.walkerCount;
+	dropletCount = header.dropletCount;
+	citySearchCount = header.citySearchCount;
+	cityLocation.x = header.cityX;
+	cityLocation.z = header.cityZ;
+	cityExpandRight = header.cityDirection == CITY_RIGHT;
+	cityExpandLeft = header.cityDirection == CITY_LEFT;
+	cityExpandUp = header.cityDirection == CITY_UP;
+	cityExpandDown = header.cityDirection == CITY_DOWN;
+
+	// Hand the mapping over only once everything succeeded, the grids may point into it.
+	// The previous mapping is closed when file goes out of scope.
+	mapping.swap(file);
+	return true;
+}
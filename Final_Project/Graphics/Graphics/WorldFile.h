@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include "Heightfield.h"
+#include "MappedFile.h"
+#include "CitySites.h"
+
+// Binary world file: a fixed header followed by one section per grid. Every section starts on a
+// WORLD_SECTION_ALIGNMENT boundary and holds the rows of a Heightfield exactly as they are laid out in memory,
+// padding included, so a mapped file can be used in place without copying.
+// All values are stored in the byte order of the machine that wrote the file; readers reject other byte orders.
+
+const char WORLD_FILE_MAGIC[8] = { 'T', 'E', 'R', 'R', 'W', 'L', 'D', 0 };
+const uint32_t WORLD_FILE_VERSION = 1;
+const uint32_t WORLD_BYTE_ORDER = 0x01020304;
+const uint64_t WORLD_SECTION_ALIGNMENT = 4096; // A page, so sections can also be mapped one by one
+
+enum WorldSectionId {
+	WORLD_SECTION_TERRAIN = 0,
+	WORLD_SECTION_WATER = 1,
+	WORLD_SECTION_COUNT = 2
+};
+
+typedef struct {
+	uint64_t offset; // From the start of the file
+	uint64_t bytes;
+} WorldSection;
+
+// Fields are ordered by size so the layout has no compiler padding
+typedef struct {
+	char magic[8];
+	uint64_t seed;
+	uint64_t faultCount;
+	uint64_t walkerCount;
+	uint64_t dropletCount;
+	uint64_t citySearchCount;
+	WorldSection sections[WORLD_SECTION_COUNT];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t headerSize;
+	uint32_t valueSize; // Bytes per height, 4 for float and 8 for double grids
+	int32_t rows, cols;
+	int32_t stride; // Elements between the starts of two rows
+	int32_t cityX, cityZ;
+	uint32_t cityDirection;
+} WorldFileHeader;
+
+// Save the grids together with the seed, the stream counters and the city state of World.h.
+// An empty waterHeight is allowed and stored as an empty section, for terrain that has no water yet.
+bool saveWorld(const char* path, const HeightMap& terrain, const HeightMap& waterHeight);
+
+// Load a file written by saveWorld and restore the seed, stream counters and city state.
+// When the file holds the same height type as HeightMap, terrain and waterHeight become views into mapping
+// and nothing is read up front; mapping has to stay open while they are in use. Writes to the grids
+// stay in memory. Returns false, leaving the world untouched, if the file is missing or not a valid world.
+bool loadWorld(const char* path, MappedFile& mapping, HeightMap& terrain, HeightMap& waterHeight);
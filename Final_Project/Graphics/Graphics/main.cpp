@@ -1,8 +1,19 @@
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <stdio.h>
 #include <math.h>
 #include "glut.h"
 #include <vector>
+#include <thread>
+#include <chrono>
+#include "Random.h"
+#include "World.h"
+#include "WorldFile.h"
+#include "StageCache.h"
+#include "TerrainChunks.h"
+#include "ErosionThread.h"
+#include "TerrainClasses.h"
 using namespace std;
 
 const int WINDOW_WIDTH = 512;
@@ -13,22 +24,55 @@ const int TEXTURE_WIDTH = 512;
 
 const double PI = 3.14156;
 
-const int GRID_SIZE = 100; // Grid size for terrain
+const int STREAM_VIEW_DISTANCE = 4; // Chunks kept around the camera chunk in streaming mode
+const size_t STREAM_MEMORY_BUDGET = 128 << 20; // Bytes of chunks kept resident in streaming mode
 
 unsigned char texture0[TEXTURE_HEIGHT][TEXTURE_WIDTH][3]; // Texture data
 double rotation_angle = 0; // Rotation angle for camera
 double displacement = 0; // Used for updating camera or other parameters
 
-// Terrain height maps and temporary buffers
-double terrain[GRID_SIZE][GRID_SIZE] = { 0 };
-double waterHeight[GRID_SIZE][GRID_SIZE] = { 0 };
-double tempBuffer[GRID_SIZE][GRID_SIZE] = { 0 };
+// Terrain height maps of the world
+int gridSize = DEFAULT_GRID_SIZE;
+HeightMap worldTerrain;
+HeightMap worldWater;
 
-// Structure for representing 2D points (used for terrain and city building)
-typedef struct {
-	int x;
-	int z;
-} Point2D;
+// Streaming mode replaces the fixed grid by chunks generated around the camera
+bool streamingMode = false;
+ChunkManager* chunkManager = NULL;
+
+// Pyramid mode forms large grids on a coarse grid and refines them up to the requested size
+bool pyramidMode = false;
+
+// Pipe mode erodes with the grid-based pipe model instead of droplets, rain collects into rivers and lakes
+bool pipeMode = false;
+
+// Rivers mode places rivers along the accumulated flow whenever erosion stops, before the city search
+bool riversMode = false;
+
+// Lakes mode keeps the depressions of the eroding terrain filled up to their spill level
+bool lakesMode = false;
+
+// Ranked mode founds the city at the best scored site instead of one drawn from the city search stream
+bool rankedMode = false;
+
+// Erodes copies of the world grids while erosion runs, display() draws its latest snapshot meanwhile
+ErosionThread* erosionThread = NULL;
+bool convergenceReported = false;
+const int IDLE_FRAME_MILLISECONDS = 33; // Frame time once erosion converged, leaves the CPU mostly idle
+
+// Dry land, river and sea of the world grids for the city search, the city and the renderer, attached once erosion
+// first stops and told about every later write to the grids
+TerrainClasses worldClasses;
+bool citySearched = false; // The city search ran on the world grids since erosion last stopped
+
+// World files: -load replaces generation by a saved world, the s key saves the current one
+const char* loadPath = NULL;
+const char* savePath = "world.terrain";
+MappedFile worldMapping; // Backs the loaded grids
+
+// -cache DIR reuses generation stages computed by earlier runs with the same seed and parameters
+const char* cachePath = "";
+StageCache* stageCache = NULL; // Kept for the whole run, the grids can point into its entries
 
 // Structure for representing 3D points (used for camera and terrain points)
 typedef struct
@@ -48,30 +92,9 @@ double rotation_speed = 0;
 double view_angle = PI;
 Point3D viewDirection = { sin(view_angle), -0.3, cos(view_angle) };
 
-Point2D cityLocation = { -100, -100 }; // Stores city position
-
-bool cityExpandRight = false;
-bool cityExpandLeft = false;
-bool cityExpandUp = false;
-bool cityExpandDown = false;
-
 bool stopErosion = false; // Flag to stop terrain erosion
 bool isTerrainForming = true; // Flag to indicate terrain formation
 
-void UpdateTerrainMethod2();
-void UpdateTerrainMethod3();
-
-void SmoothTerrain();
-
-// Initialize water height slightly below the terrain height
-void initializeWaterHeight() {
-	for (int i = 0; i < GRID_SIZE; i++) {
-		for (int j = 0; j < GRID_SIZE; j++) {
-			waterHeight[i][j] = terrain[i][j] - 0.001;
-		}
-	}
-}
-
 // Set texture for roads or bricks
 void setTexture(int textureType) {
 	int i, j;
@@ -82,9 +105,10 @@ void setTexture(int textureType) {
 	case 0: // bricks texture
 		for (int i = 0; i < WINDOW_HEIGHT; i++)
 		{
+			RandomStream texels(worldSeed, STAGE_TEXTURE, textureType * TEXTURE_HEIGHT + i); // One stream per texture row
 			for (int j = 0; j < WINDOW_WIDTH; j++)
 			{
-				randomValue = rand() % 20;
+				randomValue = texels.nextInt(20);
 				if (i < WINDOW_HEIGHT / 2) { // Upper part - white bricks
 					texture0[i][j][0] = 255 - randomValue;
 					texture0[i][j][1] = 255 - randomValue;
@@ -101,9 +125,11 @@ void setTexture(int textureType) {
 		break;
 	case 1: // road texture
 		for (i = 0; i < TEXTURE_HEIGHT; i++)
+		{
+			RandomStream texels(worldSeed, STAGE_TEXTURE, textureType * TEXTURE_HEIGHT + i); // One stream per texture row
 			for (j = 0; j < TEXTURE_WIDTH; j++)
 			{
-				randomValue = rand() % 30;
+				randomValue = texels.nextInt(30);
 				if (i > TEXTURE_HEIGHT - 15 || i < 15 ||
 					i < TEXTURE_HEIGHT / 2 && i >= TEXTURE_HEIGHT / 2 - 15 && j < TEXTURE_WIDTH / 2)
 				{
@@ -118,6 +144,7 @@ void setTexture(int textureType) {
 					texture0[i][j][2] = 140 + randomValue;
 				}
 			}
+		}
 		break;
 	}
 }
@@ -125,23 +152,56 @@ void setTexture(int textureType) {
 // Initialize scene, including terrain and textures
 void initializeScene()
 {
-	int i, j;
 	glClearColor(0.5, 0.7, 0.9, 0); // Background color
 	glEnable(GL_DEPTH_TEST);
 
-	srand(time(0)); // Seed random number generator
+	bool loaded = false;
+	if (loadPath != NULL && !streamingMode)
+	{
+		loaded = loadWorld(loadPath, worldMapping, worldTerrain, worldWater);
+		if (!loaded)
+			printf("cannot load a world from %s, generating a new one\n", loadPath);
+	}
 
-	// Initial terrain formation using two different methods
-	for (i = 0; i < 4000; i++)
-		UpdateTerrainMethod2();
-	for (i = 0; i < 500; i++)
-		UpdateTerrainMethod3();
-	SmoothTerrain(); // Smooth the terrain
+	if (streamingMode)
+	{
+		// One thread is left for rendering
+		chunkManager = new ChunkManager(worldSeed, defaultChunkSettings(), STREAM_VIEW_DISTANCE, STREAM_MEMORY_BUDGET,
+			max(1, defaultThreadCount() - 1));
+	}
+	else if (loaded)
+	{
+		gridSize = worldTerrain.height();
+	}
+	else
+	{
+		// The stages have the same names and parameters as in TerrainCli, so both share cache entries
+		worldTerrain.resize(gridSize, gridSize);
+		stageCache = new StageCache(cachePath, worldSeed, gridSize, gridSize, worldTerrain, worldWater);
 
-	for (i = 0; i < 15; i++)
-		UpdateTerrainMethod3();
+		if (pyramidMode && gridSize > DEFAULT_GRID_SIZE)
+		{
+			stageCache->run("pyramid", { (double)gridSize }, [](HeightMap& terrain, HeightMap& waterHeight) { generateTerrainPyramid(terrain, gridSize); });
+		}
+		else
+		{
+			// Initial terrain formation using two different methods
+			stageCache->run("faults", { 4000 }, [](HeightMap& terrain, HeightMap& waterHeight) { UpdateTerrainMethod2(terrain, 4000); });
+			stageCache->run("random walk", { 500, 800 }, [](HeightMap& terrain, HeightMap& waterHeight) { UpdateTerrainMethod3(terrain, 500, 800); });
+			stageCache->run("smooth", { 1 }, [](HeightMap& terrain, HeightMap& waterHeight) { SmoothTerrain(terrain, 1); }); // Smooth the terrain
 
-	initializeWaterHeight();
+			stageCache->run("detail walk", { 15, 800 }, [](HeightMap& terrain, HeightMap& waterHeight) { UpdateTerrainMethod3(terrain, 15, 800); });
+		}
+
+		stageCache->run("water init", {}, [](HeightMap& terrain, HeightMap& waterHeight) { initializeWaterHeight(terrain, waterHeight); });
+		stageCache->finish();
+	}
+
+	// Passing the seed as the first argument reproduces the run, a loaded world has the seed it was saved with
+	printf("world seed %llu\n", (unsigned long long)worldSeed);
+
+	if (!streamingMode)
+		erosionThread = new ErosionThread();
 
 	// Road texture
 	setTexture(1); // Assign texture type 1 (road)
@@ -162,282 +222,48 @@ void initializeScene()
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, TEXTURE_WIDTH, TEXTURE_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, texture0);
 }
 
-// Modify the terrain with a linear erosion model
-void UpdateTerrainMethod2()
-{
-	int x1, z1, x2, z2;
-	double delta = 0.05;
-	double slope, intercept;
-	int i, j;
-
-	if (rand() % 2 == 0)
-		delta = -delta;
-
-	x1 = rand() % GRID_SIZE;
-	z1 = rand() % GRID_SIZE;
-
-	x2 = rand() % GRID_SIZE;
-	z2 = rand() % GRID_SIZE;
-
-	if (x1 != x2)
-	{
-		slope = (z2 - z1) / ((double)(x2 - x1));
-		intercept = z1 - slope * x1;
-
-		for (i = 0; i < GRID_SIZE; i++)
-			for (j = 0; j < GRID_SIZE; j++)
-			{
-				if (i < slope * j + intercept) terrain[i][j] += delta;
-				else terrain[i][j] -= delta;
-			}
-	}
-}
-
-// Checks if a position is underwater (for sea level)
-bool isUnderSeaLevel(int x, int z) {
-	return x >= 0 && x < GRID_SIZE && z >= 0 && z < GRID_SIZE && 0 > terrain[x][z] && 0 > waterHeight[x][z];
-}
-
-// Checks if a position is underwater (for river level)
-bool isUnderRiverLevel(int x, int z) {
-	return x >= 0 && x < GRID_SIZE && z >= 0 && z < GRID_SIZE && 0 < waterHeight[x][z] && terrain[x][z] < waterHeight[x][z];
-}
-
-// Checks if the point is above water (both sea and river)
-bool isAboveWater(int x, int z) {
-	return x >= 0 && x < GRID_SIZE && z >= 0 && z < GRID_SIZE && terrain[x][z] > 0 && terrain[x][z] > waterHeight[x][z];
-}
-
-// Flood fill algorithm using stack to avoid recursion overflow
-void floodFill(int x, int z)
-{
-	bool visited[GRID_SIZE][GRID_SIZE] = { false };
-	vector <Point2D> stack;
-
-	Point2D current = { x, z };
-	stack.push_back(current);
-
-	while (!stack.empty())
-	{
-		current = stack.back();
-		stack.pop_back();
-
-		x = current.x;
-		z = current.z;
-		if (isAboveWater(x, z) && isAboveWater(x, z - 1) && isAboveWater(x, z + 1) && isAboveWater(x - 1, z) && isAboveWater(x - 1, z - 1) && isAboveWater(x - 1, z + 1) && isUnderRiverLevel(x + 2, z) && isUnderRiverLevel(x + 3, z) && ((isUnderRiverLevel(x + 2, z + 1) && isUnderRiverLevel(x + 2, z + 2) && isUnderRiverLevel(x + 2, z + 3) && isUnderSeaLevel(x + 2, z + 4)) || (isUnderRiverLevel(x + 2, z - 1) && isUnderRiverLevel(x + 2, z - 2) && isUnderRiverLevel(x + 2, z - 3) && isUnderSeaLevel(x + 2, z - 4)))) {
-			cityLocation.x = x;
-			cityLocation.z = z;
-			cityExpandRight = true;
-			return;
-		}
-		else if (isAboveWater(x, z) && isAboveWater(x, z - 1) && isAboveWater(x, z + 1) && isAboveWater(x + 1, z) && isAboveWater(x + 1, z - 1) && isAboveWater(x + 1, z + 1) && isUnderRiverLevel(x - 2, z) && isUnderRiverLevel(x - 3, z) && ((isUnderRiverLevel(x - 2, z + 1) && isUnderRiverLevel(x - 2, z + 2) && isUnderRiverLevel(x - 2, z + 3) && isUnderSeaLevel(x - 2, z + 4)) || (isUnderRiverLevel(x - 2, z - 1) && isUnderRiverLevel(x - 2, z - 2) && isUnderRiverLevel(x - 2, z - 3) && isUnderSeaLevel(x - 2, z - 4)))) {
-			cityLocation.x = x;
-			cityLocation.z = z;
-			cityExpandLeft = true;
-			return;
-		}
-		else if (isAboveWater(x, z) && isAboveWater(x - 1, z) && isAboveWater(x + 1, z) && isAboveWater(x, z - 1) && isAboveWater(x - 1, z - 1) && isAboveWater(x + 1, z - 1) && isUnderRiverLevel(x, z + 2) && isUnderRiverLevel(x, z + 3) && ((isUnderRiverLevel(x + 1, z + 2) && isUnderRiverLevel(x + 2, z + 2) && isUnderRiverLevel(x + 3, z + 2) && isUnderSeaLevel(x + 4, z + 2)) || (isUnderRiverLevel(x - 1, z + 2) && isUnderRiverLevel(x - 2, z + 2) && isUnderRiverLevel(x - 3, z + 2) && isUnderSeaLevel(x - 4, z + 2)))) {
-			cityLocation.x = x;
-			cityLocation.z = z;
-			cityExpandUp = true;
-			return;
-		}
-		else if (isAboveWater(x, z) && isAboveWater(x - 1, z) && isAboveWater(x + 1, z) && isAboveWater(x, z + 1) && isAboveWater(x - 1, z + 1) && isAboveWater(x + 1, z + 1) && isUnderRiverLevel(x, z - 2) && isUnderRiverLevel(x, z - 3) && ((isUnderRiverLevel(x + 1, z - 2) && isUnderRiverLevel(x + 2, z - 2) && isUnderRiverLevel(x + 3, z - 2) && isUnderSeaLevel(x + 4, z - 2)) || (isUnderRiverLevel(x - 1, z - 2) && isUnderRiverLevel(x - 2, z - 2) && isUnderRiverLevel(x - 3, z - 2) && isUnderSeaLevel(x - 4, z - 2)))) {
-			cityLocation.x = x;
-			cityLocation.z = z;
-			cityExpandDown = true;
-			return;
-		}
-		else {
-			if (x + 1 < GRID_SIZE && !visited[x + 1][z])
-			{
-				current.x = x + 1;
-				current.z = z;
-				stack.push_back(current);
-			}
-			if (x - 1 >= 0 && !visited[x - 1][z])
-			{
-				current.x = x - 1;
-				current.z = z;
-				stack.push_back(current);
-			}
-			if (z + 1 < GRID_SIZE && !visited[x][z + 1])
-			{
-				current.x = x;
-				current.z = z + 1;
-				stack.push_back(current);
-			}
-			if (z - 1 >= 0 && !visited[x][z - 1])
-			{
-				current.x = x;
-				current.z = z - 1;
-				stack.push_back(current);
-			}
-		}
-		visited[x][z] = true;
-	}
-}
-
-// Hydraulic erosion simulation
-void hydraulicErosion() {
-	int x = rand() % GRID_SIZE;
-	int z = rand() % GRID_SIZE;
-	bool erosionContinues = false;
-	do
-	{
-		erosionContinues = false;
-		Point3D currentPoint = { x, terrain[x][z], z };
-
-		// Check the neighboring points for lower height
-		if (x < 99) {
-			Point3D neighborPoint = { x + 1, terrain[x + 1][z], z };
-			if (neighborPoint.y < currentPoint.y) {
-				currentPoint.y = neighborPoint.y;
-				currentPoint.x = neighborPoint.x;
-				currentPoint.z = neighborPoint.z;
-				erosionContinues = true;
-			}
-		}
-
-		if (z < 99) {
-			Point3D neighborPoint = { x, terrain[x][z + 1], z + 1 };
-			if (neighborPoint.y < currentPoint.y) {
-				currentPoint.y = neighborPoint.y;
-				currentPoint.x = neighborPoint.x;
-				currentPoint.z = neighborPoint.z;
-				erosionContinues = true;
-			}
-		}
-
-		if (x > 0) {
-			Point3D neighborPoint = { x - 1, terrain[x - 1][z], z };
-			if (neighborPoint.y < currentPoint.y) {
-				currentPoint.y = neighborPoint.y;
-				currentPoint.x = neighborPoint.x;
-				currentPoint.z = neighborPoint.z;
-				erosionContinues = true;
-			}
-		}
-
-		if (z > 0) {
-			Point3D neighborPoint = { x, terrain[x][z - 1], z - 1 };
-			if (neighborPoint.y < currentPoint.y) {
-				currentPoint.y = neighborPoint.y;
-				currentPoint.x = neighborPoint.x;
-				currentPoint.z = neighborPoint.z;
-				erosionContinues = true;
-			}
-		}
-
-		// Apply erosion to the current point
-		terrain[x][z] -= 0.0001;
-
-		// Move to the next point
-		x = currentPoint.x;
-		z = currentPoint.z;
-	} while (erosionContinues);
-}
-
-// Random walk terrain modification
-void UpdateTerrainMethod3()
-{
-	double delta = 0.02;
-	int x, z, count;
-	int numSteps = 800;
-
-	x = rand() % GRID_SIZE;
-	z = rand() % GRID_SIZE;
-
-	if (rand() % 2 == 0)
-		delta = -delta;
-
-	for (count = 1; count <= numSteps; count++)
-	{
-		terrain[z][x] += delta;
-		switch (rand() % 4)
-		{
-		case 0: // right
-			x++;
-			break;
-		case 1: // up
-			z++;
-			break;
-		case 2: // down
-			z--;
-			break;
-		case 3: // left
-			x--;
-			break;
-		}
-		x += GRID_SIZE;
-		x = x % GRID_SIZE;
-		z += GRID_SIZE;
-		z = z % GRID_SIZE;
-	}
-
-
-}
-
-// Apply a smoothing filter to the terrain
-void SmoothTerrain()
-{
-	int i, j;
-
-	for (i = 1; i < GRID_SIZE - 1; i++)
-		for (j = 1; j < GRID_SIZE - 1; j++)
-		{
-			tempBuffer[i][j] = (terrain[i + 1][j - 1] + 2 * terrain[i + 1][j] + terrain[i + 1][j + 1] +
-				2 * terrain[i][j - 1] + 4 * terrain[i][j] + 2 * terrain[i][j + 1] +
-				terrain[i - 1][j - 1] + 2 * terrain[i - 1][j] + terrain[i - 1][j + 1]) / 16.0;
-		}
-
-	for (i = 1; i < GRID_SIZE - 1; i++)
-		for (j = 1; j < GRID_SIZE - 1; j++)
-			terrain[i][j] = tempBuffer[i][j];
-
-}
-
 // Set color based on terrain height
 void SetTerrainColor(double height)
 {
-	height = fabs(height) / 10.0;
-
-	if (height < 0.03) // sand
-		glColor3d(0.9, 0.8, 0.7);
-	else if (height < 0.5)// grass
-		glColor3d(0.2 + height / 3, 0.5 - height / 2, 0);
-	else
-		glColor3d(1.2 * height, 1.2 * height, 1.3 * height);
+	float color[3];
+	terrainColor(height, color);
+	glColor3fv(color);
 }
 
-// Draw the terrain grid
-void DrawTerrain()
+// Draw the terrain grid. With classes, the water surface is left out of squares whose four corners are dry land,
+// where it lies under the terrain.
+void DrawTerrain(const HeightMap& terrain, const HeightMap& waterHeight, TerrainClasses* classes)
 {
 	int i, j;
+	int halfWidth = terrain.width() / 2;
+	int halfHeight = terrain.height() / 2;
+	AreaTables* areas = classes != NULL ? &classes->areas() : NULL;
 
 	glColor3d(0, 0, 0.3);
 
-	for (i = 1; i < GRID_SIZE; i++)
-		for (j = 1; j < GRID_SIZE; j++)
+	for (i = 1; i < terrain.height(); i++)
+		for (j = 1; j < terrain.width(); j++)
 		{
 			glBegin(GL_POLYGON);
-			SetTerrainColor(terrain[i][j]);
-			glVertex3d(j - GRID_SIZE / 2, terrain[i][j], i - GRID_SIZE / 2);
-			SetTerrainColor(terrain[i - 1][j]);
-			glVertex3d(j - GRID_SIZE / 2, terrain[i - 1][j], i - 1 - GRID_SIZE / 2);
-			SetTerrainColor(terrain[i - 1][j - 1]);
-			glVertex3d(j - 1 - GRID_SIZE / 2, terrain[i - 1][j - 1], i - 1 - GRID_SIZE / 2);
-			SetTerrainColor(terrain[i][j - 1]);
-			glVertex3d(j - 1 - GRID_SIZE / 2, terrain[i][j - 1], i - GRID_SIZE / 2);
+			SetTerrainColor(terrain(i, j));
+			glVertex3d(j - halfWidth, terrain(i, j), i - halfHeight);
+			SetTerrainColor(terrain(i - 1, j));
+			glVertex3d(j - halfWidth, terrain(i - 1, j), i - 1 - halfHeight);
+			SetTerrainColor(terrain(i - 1, j - 1));
+			glVertex3d(j - 1 - halfWidth, terrain(i - 1, j - 1), i - 1 - halfHeight);
+			SetTerrainColor(terrain(i, j - 1));
+			glVertex3d(j - 1 - halfWidth, terrain(i, j - 1), i - halfHeight);
 			glEnd();
 
 			// Draw the river water surface
+			if (areas != NULL && areas->allDry(i - 1, j - 1, 2, 2))
+				continue;
 			glBegin(GL_POLYGON);
 			glColor3d(0, 0.25, 0.6);
-			glVertex3d(j - GRID_SIZE / 2, waterHeight[i][j], i - GRID_SIZE / 2);
-			glVertex3d(j - GRID_SIZE / 2, waterHeight[i - 1][j], i - 1 - GRID_SIZE / 2);
-			glVertex3d(j - 1 - GRID_SIZE / 2, waterHeight[i - 1][j - 1], i - 1 - GRID_SIZE / 2);
-			glVertex3d(j - 1 - GRID_SIZE / 2, waterHeight[i][j - 1], i - GRID_SIZE / 2);
+			glVertex3d(j - halfWidth, waterHeight(i, j), i - halfHeight);
+			glVertex3d(j - halfWidth, waterHeight(i - 1, j), i - 1 - halfHeight);
+			glVertex3d(j - 1 - halfWidth, waterHeight(i - 1, j - 1), i - 1 - halfHeight);
+			glVertex3d(j - 1 - halfWidth, waterHeight(i, j - 1), i - halfHeight);
 			glEnd();
 		}
 
@@ -447,10 +273,50 @@ void DrawTerrain()
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glColor4d(0, 0.3, 0.6, 0.8);
 	glBegin(GL_POLYGON);
-	glVertex3d(-GRID_SIZE / 2, 0, -GRID_SIZE / 2);
-	glVertex3d(-GRID_SIZE / 2, 0, GRID_SIZE / 2);
-	glVertex3d(GRID_SIZE / 2, 0, GRID_SIZE / 2);
-	glVertex3d(GRID_SIZE / 2, 0, -GRID_SIZE / 2);
+	glVertex3d(-halfWidth, 0, -halfHeight);
+	glVertex3d(-halfWidth, 0, halfHeight);
+	glVertex3d(halfWidth, 0, halfHeight);
+	glVertex3d(halfWidth, 0, -halfHeight);
+	glEnd();
+
+	glDisable(GL_BLEND);
+}
+
+// Draw the resident chunks around the camera from their prebuilt vertex arrays
+void DrawChunks(const ChunkManager& manager)
+{
+	const vector<const TerrainChunk*>& chunks = manager.visibleChunks();
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	for (size_t c = 0; c < chunks.size(); c++)
+	{
+		glVertexPointer(3, GL_FLOAT, 0, &chunks[c]->vertices[0]);
+		glColorPointer(3, GL_FLOAT, 0, &chunks[c]->colors[0]);
+		glDrawArrays(GL_QUADS, 0, (GLsizei)(chunks[c]->vertices.size() / 3));
+	}
+	glDisableClientState(GL_COLOR_ARRAY);
+
+	// Draw the river water surfaces
+	glColor3d(0, 0.25, 0.6);
+	for (size_t c = 0; c < chunks.size(); c++)
+		if (!chunks[c]->waterVertices.empty())
+		{
+			glVertexPointer(3, GL_FLOAT, 0, &chunks[c]->waterVertices[0]);
+			glDrawArrays(GL_QUADS, 0, (GLsizei)(chunks[c]->waterVertices.size() / 3));
+		}
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	// Draw the sea (transparent) over the streamed area
+	double extent = (STREAM_VIEW_DISTANCE + 1) * manager.chunkSize();
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glColor4d(0, 0.3, 0.6, 0.8);
+	glBegin(GL_POLYGON);
+	glVertex3d(cameraPosition.x - extent, 0, cameraPosition.z - extent);
+	glVertex3d(cameraPosition.x - extent, 0, cameraPosition.z + extent);
+	glVertex3d(cameraPosition.x + extent, 0, cameraPosition.z + extent);
+	glVertex3d(cameraPosition.x + extent, 0, cameraPosition.z - extent);
 	glEnd();
 
 	glDisable(GL_BLEND);
@@ -556,32 +422,32 @@ void drawBuilding(int numFloors, int numWindows) {
 }
 
 // Check if there's enough space to place a building
-bool checkBuildingSpace(int x, int z) {
-	return x - 1 >= 0 && x + 1 < GRID_SIZE && z - 1 >= 0 && z + 1 < GRID_SIZE && isAboveWater(x, z) && isAboveWater(x, z - 1) && isAboveWater(x, z + 1) && isAboveWater(x + 1, z) && isAboveWater(x + 1, z - 1) && isAboveWater(x + 1, z + 1) && isAboveWater(x - 1, z) && isAboveWater(x - 1, z - 1) && isAboveWater(x - 1, z + 1);
+bool checkBuildingSpace(TerrainClasses& classes, int x, int z) {
+	return classes.areas().allDry(x - 1, z - 1, 3, 3);
 }
 
 // Function to build roads to the right
-void buildRoadRight(int x, int z)
+void buildRoadRight(const HeightMap& terrain, int x, int z)
 {
 	glBegin(GL_POLYGON);
-	glTexCoord2d(0, 2); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x - 1][z + 1] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x - 1][z - 1] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x][z - 1] + 0.1, x - GRID_SIZE / 2);
-	glTexCoord2d(1, 2); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x][z + 1] + 0.1, x - GRID_SIZE / 2);
+	glTexCoord2d(0, 2); glVertex3d(z + 1 - terrain.width() / 2, terrain(x - 1, z + 1) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x - 1, z - 1) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x, z - 1) + 0.1, x - terrain.height() / 2);
+	glTexCoord2d(1, 2); glVertex3d(z + 1 - terrain.width() / 2, terrain(x, z + 1) + 0.1, x - terrain.height() / 2);
 	glEnd();
 }
 
 // Function to build crosswalks to the right
-void buildCrosswalkRight(int x, int z)
+void buildCrosswalkRight(const HeightMap& terrain, int x, int z)
 {
 	glBindTexture(GL_TEXTURE_2D, 2);
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
 	glBegin(GL_POLYGON);
-	glTexCoord2d(0, 10.5); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x - 1][z + 1] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x - 1][z - 1] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x][z - 1] + 0.1, x - GRID_SIZE / 2);
-	glTexCoord2d(1, 10.5); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x][z + 1] + 0.1, x - GRID_SIZE / 2);
+	glTexCoord2d(0, 10.5); glVertex3d(z + 1 - terrain.width() / 2, terrain(x - 1, z + 1) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x - 1, z - 1) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x, z - 1) + 0.1, x - terrain.height() / 2);
+	glTexCoord2d(1, 10.5); glVertex3d(z + 1 - terrain.width() / 2, terrain(x, z + 1) + 0.1, x - terrain.height() / 2);
 	glEnd();
 
 	glBindTexture(GL_TEXTURE_2D, 1);
@@ -589,32 +455,32 @@ void buildCrosswalkRight(int x, int z)
 }
 
 // Build the city expanding to the right
-void buildCityRight() {
+void buildCityRight(HeightMap& terrain, HeightMap& waterHeight, TerrainClasses& classes) {
 	bool buildingPlaced = true;
 	int x = cityLocation.x;
 	int z = cityLocation.z;
 	int counter = 0;
-	while (x > 0 && isAboveWater(x, z) && isAboveWater(x, z - 1) && isAboveWater(x, z + 1) && isAboveWater(x - 1, z) && isAboveWater(x - 1, z - 1) && isAboveWater(x - 1, z + 1) && z - 2 >= 0 && z + 2 < GRID_SIZE) {
+	while (x > 0 && classes.areas().allDry(x - 1, z - 1, 2, 3) && z - 2 >= 0 && z + 2 < terrain.width()) {
 		// Place buildings
-		if (counter % 2 == 0 && checkBuildingSpace(x, z - 2))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x, z - 2))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 1;
 			int numOfFloors = (counter % 4) + 1;
 			glPushMatrix();
-			glTranslated(z - 2 - GRID_SIZE / 2, terrain[x][z - 2] + 0.15, x - GRID_SIZE / 2);
+			glTranslated(z - 2 - terrain.width() / 2, terrain(x, z - 2) + 0.15, x - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
 			glPopMatrix();
 		}
-		if (counter % 2 == 0 && checkBuildingSpace(x, z + 2))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x, z + 2))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 2;
 			int numOfFloors = (counter % 4) + 2;
 			glPushMatrix();
-			glTranslated(z + 2 - GRID_SIZE / 2, terrain[x][z + 2] + 0.15, x - GRID_SIZE / 2);
+			glTranslated(z + 2 - terrain.width() / 2, terrain(x, z + 2) + 0.15, x - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
@@ -625,15 +491,16 @@ void buildCityRight() {
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, 1);
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-		terrain[x][z - 2] = terrain[x][z + 2] = terrain[x][z - 1] = terrain[x][z + 1] = terrain[x][z];
-		terrain[x - 1][z - 2] = terrain[x - 1][z + 2] = terrain[x - 1][z - 1] = terrain[x - 1][z + 1] = terrain[x - 1][z];
-		waterHeight[x][z - 2] = waterHeight[x][z + 2] = waterHeight[x][z - 1] = waterHeight[x][z + 1] = waterHeight[x][z] = -1;
-		waterHeight[x - 1][z - 2] = waterHeight[x - 1][z + 2] = waterHeight[x - 1][z - 1] = waterHeight[x - 1][z + 1] = waterHeight[x - 1][z] = -1;
+		terrain(x, z - 2) = terrain(x, z + 2) = terrain(x, z - 1) = terrain(x, z + 1) = terrain(x, z);
+		terrain(x - 1, z - 2) = terrain(x - 1, z + 2) = terrain(x - 1, z - 1) = terrain(x - 1, z + 1) = terrain(x - 1, z);
+		waterHeight(x, z - 2) = waterHeight(x, z + 2) = waterHeight(x, z - 1) = waterHeight(x, z + 1) = waterHeight(x, z) = -1;
+		waterHeight(x - 1, z - 2) = waterHeight(x - 1, z + 2) = waterHeight(x - 1, z - 1) = waterHeight(x - 1, z + 1) = waterHeight(x - 1, z) = -1;
+		classes.changed(x - 1, z - 2, 2, 5);
 		if (counter % 8 == 0) {//crosswalk
-			buildCrosswalkRight(x, z);
+			buildCrosswalkRight(terrain, x, z);
 		}
 		else {//road
-			buildRoadRight(x, z);
+			buildRoadRight(terrain, x, z);
 		}
 		glDisable(GL_TEXTURE_2D);
 		x--;
@@ -642,16 +509,16 @@ void buildCityRight() {
 }
 
 // Build crosswalks to the left
-void buildCrosswalkLeft(int x, int z)
+void buildCrosswalkLeft(const HeightMap& terrain, int x, int z)
 {
 	glBindTexture(GL_TEXTURE_2D, 2);
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
 	glBegin(GL_POLYGON);
-	glTexCoord2d(0, 10.5); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x + 1][z + 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x + 1][z - 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x][z - 1] + 0.1, x - GRID_SIZE / 2);
-	glTexCoord2d(1, 10.5); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x][z + 1] + 0.1, x - GRID_SIZE / 2);
+	glTexCoord2d(0, 10.5); glVertex3d(z + 1 - terrain.width() / 2, terrain(x + 1, z + 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x + 1, z - 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x, z - 1) + 0.1, x - terrain.height() / 2);
+	glTexCoord2d(1, 10.5); glVertex3d(z + 1 - terrain.width() / 2, terrain(x, z + 1) + 0.1, x - terrain.height() / 2);
 	glEnd();
 
 	glBindTexture(GL_TEXTURE_2D, 1);
@@ -659,44 +526,44 @@ void buildCrosswalkLeft(int x, int z)
 }
 
 // Build roads to the left
-void buildRoadLeft(int x, int z)
+void buildRoadLeft(const HeightMap& terrain, int x, int z)
 {
 	glBegin(GL_POLYGON);
-	glTexCoord2d(1, 2); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x + 1][z + 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x + 1][z - 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x][z - 1] + 0.1, x - GRID_SIZE / 2);
-	glTexCoord2d(0, 2); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x][z + 1] + 0.1, x - GRID_SIZE / 2);
+	glTexCoord2d(1, 2); glVertex3d(z + 1 - terrain.width() / 2, terrain(x + 1, z + 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x + 1, z - 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x, z - 1) + 0.1, x - terrain.height() / 2);
+	glTexCoord2d(0, 2); glVertex3d(z + 1 - terrain.width() / 2, terrain(x, z + 1) + 0.1, x - terrain.height() / 2);
 	glEnd();
 }
 
 // Build the city expanding to the left
-void buildCityLeft() {
+void buildCityLeft(HeightMap& terrain, HeightMap& waterHeight, TerrainClasses& classes) {
 	bool buildingPlaced = true;
 	int x = cityLocation.x;
 	int z = cityLocation.z;
 	int counter = 0;
 	// Loop to place city roads and buildings
-	while (x + 1 < GRID_SIZE && isAboveWater(x, z) && isAboveWater(x, z - 1) && isAboveWater(x, z + 1) && isAboveWater(x + 1, z) && isAboveWater(x + 1, z - 1) && isAboveWater(x + 1, z + 1) && z - 1 >= 0 && z + 1 < GRID_SIZE) {
+	while (x + 1 < terrain.height() && classes.areas().allDry(x, z - 1, 2, 3) && z - 1 >= 0 && z + 1 < terrain.width()) {
 		// Place buildings
-		if (counter % 2 == 0 && checkBuildingSpace(x, z - 2))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x, z - 2))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 1;
 			int numOfFloors = (counter % 4) + 1;
 			glPushMatrix();
-			glTranslated(z - 2 - GRID_SIZE / 2, terrain[x][z - 2] + 0.15, x - GRID_SIZE / 2);
+			glTranslated(z - 2 - terrain.width() / 2, terrain(x, z - 2) + 0.15, x - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
 			glPopMatrix();
 		}
-		if (counter % 2 == 0 && checkBuildingSpace(x, z + 2))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x, z + 2))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 2;
 			int numOfFloors = (counter % 4) + 2;
 			glPushMatrix();
-			glTranslated(z + 2 - GRID_SIZE / 2, terrain[x][z + 2] + 0.15, x - GRID_SIZE / 2);
+			glTranslated(z + 2 - terrain.width() / 2, terrain(x, z + 2) + 0.15, x - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
@@ -706,17 +573,18 @@ void buildCityLeft() {
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, 1);
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-		terrain[x][z - 2] = terrain[x][z + 2] = terrain[x][z - 1] = terrain[x][z + 1] = terrain[x][z];
-		terrain[x + 1][z - 2] = terrain[x + 1][z + 2] = terrain[x + 1][z - 1] = terrain[x + 1][z + 1] = terrain[x + 1][z];
-		waterHeight[x][z - 2] = waterHeight[x][z + 2] = waterHeight[x][z - 1] = waterHeight[x][z + 1] = waterHeight[x][z] = -1;
-		waterHeight[x + 1][z - 2] = waterHeight[x + 1][z + 2] = waterHeight[x + 1][z - 1] = waterHeight[x + 1][z + 1] = waterHeight[x + 1][z] = -1;
+		terrain(x, z - 2) = terrain(x, z + 2) = terrain(x, z - 1) = terrain(x, z + 1) = terrain(x, z);
+		terrain(x + 1, z - 2) = terrain(x + 1, z + 2) = terrain(x + 1, z - 1) = terrain(x + 1, z + 1) = terrain(x + 1, z);
+		waterHeight(x, z - 2) = waterHeight(x, z + 2) = waterHeight(x, z - 1) = waterHeight(x, z + 1) = waterHeight(x, z) = -1;
+		waterHeight(x + 1, z - 2) = waterHeight(x + 1, z + 2) = waterHeight(x + 1, z - 1) = waterHeight(x + 1, z + 1) = waterHeight(x + 1, z) = -1;
+		classes.changed(x, z - 2, 2, 5);
 
 		// Draw crosswalks or roads
 		if (counter % 8 == 0) {//crosswalk
-			buildCrosswalkLeft(x, z);
+			buildCrosswalkLeft(terrain, x, z);
 		}
 		else {//road
-			buildRoadLeft(x, z);
+			buildRoadLeft(terrain, x, z);
 		}
 		glDisable(GL_TEXTURE_2D);
 		counter++;
@@ -725,16 +593,16 @@ void buildCityLeft() {
 }
 
 // Build crosswalks upwards
-void buildCrosswalkUp(int x, int z)
+void buildCrosswalkUp(const HeightMap& terrain, int x, int z)
 {
 	glBindTexture(GL_TEXTURE_2D, 2);
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
 	glBegin(GL_POLYGON);
-	glTexCoord2d(0, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x - 1][z - 1] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 10.5); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x + 1][z - 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 10.5); glVertex3d(z - GRID_SIZE / 2, terrain[x + 1][z] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z - GRID_SIZE / 2, terrain[x - 1][z] + 0.1, x - 1 - GRID_SIZE / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x - 1, z - 1) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(0, 10.5); glVertex3d(z - 1 - terrain.width() / 2, terrain(x + 1, z - 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 10.5); glVertex3d(z - terrain.width() / 2, terrain(x + 1, z) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z - terrain.width() / 2, terrain(x - 1, z) + 0.1, x - 1 - terrain.height() / 2);
 	glEnd();
 
 	glBindTexture(GL_TEXTURE_2D, 1);
@@ -742,44 +610,44 @@ void buildCrosswalkUp(int x, int z)
 }
 
 // Build roads upwards
-void buildRoadUp(int x, int z)
+void buildRoadUp(const HeightMap& terrain, int x, int z)
 {
 	glBegin(GL_POLYGON);
-	glTexCoord2d(0, 0); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x - 1][z - 1] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 2); glVertex3d(z - 1 - GRID_SIZE / 2, terrain[x + 1][z - 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 2); glVertex3d(z - GRID_SIZE / 2, terrain[x + 1][z] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z - GRID_SIZE / 2, terrain[x - 1][z] + 0.1, x - 1 - GRID_SIZE / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - 1 - terrain.width() / 2, terrain(x - 1, z - 1) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(0, 2); glVertex3d(z - 1 - terrain.width() / 2, terrain(x + 1, z - 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 2); glVertex3d(z - terrain.width() / 2, terrain(x + 1, z) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z - terrain.width() / 2, terrain(x - 1, z) + 0.1, x - 1 - terrain.height() / 2);
 	glEnd();
 }
 
 // Build the city expanding upwards
-void buildCityUp() {
+void buildCityUp(HeightMap& terrain, HeightMap& waterHeight, TerrainClasses& classes) {
 	bool buildingPlaced = true;
 	int x = cityLocation.x;
 	int z = cityLocation.z;
 	int counter = 0;
 	// Loop to place city roads and buildings
-	while (z > 0 && isAboveWater(x, z) && isAboveWater(x - 1, z) && isAboveWater(x + 1, z) && isAboveWater(x, z - 1) && isAboveWater(x - 1, z - 1) && isAboveWater(x + 1, z - 1) && x - 1 >= 0 && x + 1 < GRID_SIZE) {
+	while (z > 0 && classes.areas().allDry(x - 1, z - 1, 3, 2) && x - 1 >= 0 && x + 1 < terrain.height()) {
 		// Place buildings
-		if (counter % 2 == 0 && checkBuildingSpace(x - 2, z))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x - 2, z))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 1;
 			int numOfFloors = (counter % 4) + 1;
 			glPushMatrix();
-			glTranslated(z - GRID_SIZE / 2, terrain[x - 2][z] + 0.15, x - 2 - GRID_SIZE / 2);
+			glTranslated(z - terrain.width() / 2, terrain(x - 2, z) + 0.15, x - 2 - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
 			glPopMatrix();
 		}
-		if (counter % 2 == 0 && checkBuildingSpace(x + 2, z))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x + 2, z))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 2;
 			int numOfFloors = (counter % 4) + 2;
 			glPushMatrix();
-			glTranslated(z - GRID_SIZE / 2, terrain[x + 2][z] + 0.15, x + 2 - GRID_SIZE / 2);
+			glTranslated(z - terrain.width() / 2, terrain(x + 2, z) + 0.15, x + 2 - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
@@ -789,15 +657,16 @@ void buildCityUp() {
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, 1);
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-		terrain[x - 2][z] = terrain[x + 2][z] = terrain[x - 1][z] = terrain[x + 1][z] = terrain[x][z];
-		terrain[x - 2][z - 1] = terrain[x + 2][z - 1] = terrain[x - 1][z - 1] = terrain[x + 1][z - 1] = terrain[x][z - 1];
-		waterHeight[x - 2][z] = waterHeight[x + 2][z] = waterHeight[x - 1][z] = waterHeight[x + 1][z] = waterHeight[x][z] = -1;
-		waterHeight[x - 2][z - 1] = waterHeight[x + 2][z - 1] = waterHeight[x - 1][z - 1] = waterHeight[x + 1][z - 1] = waterHeight[x][z - 1] = -1;
+		terrain(x - 2, z) = terrain(x + 2, z) = terrain(x - 1, z) = terrain(x + 1, z) = terrain(x, z);
+		terrain(x - 2, z - 1) = terrain(x + 2, z - 1) = terrain(x - 1, z - 1) = terrain(x + 1, z - 1) = terrain(x, z - 1);
+		waterHeight(x - 2, z) = waterHeight(x + 2, z) = waterHeight(x - 1, z) = waterHeight(x + 1, z) = waterHeight(x, z) = -1;
+		waterHeight(x - 2, z - 1) = waterHeight(x + 2, z - 1) = waterHeight(x - 1, z - 1) = waterHeight(x + 1, z - 1) = waterHeight(x, z - 1) = -1;
+		classes.changed(x - 2, z - 1, 5, 2);
 		if (counter % 8 == 0) {//crosswalk
-			buildCrosswalkUp(x, z);
+			buildCrosswalkUp(terrain, x, z);
 		}
 		else {//road
-			buildRoadUp(x, z);
+			buildRoadUp(terrain, x, z);
 		}
 		glDisable(GL_TEXTURE_2D);
 		counter++;
@@ -806,16 +675,16 @@ void buildCityUp() {
 }
 
 // Build crosswalks downwards
-void buildCrosswalkDown(int x, int z)
+void buildCrosswalkDown(const HeightMap& terrain, int x, int z)
 {
 	glBindTexture(GL_TEXTURE_2D, 2);
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
 	glBegin(GL_POLYGON);
-	glTexCoord2d(0, 0); glVertex3d(z - GRID_SIZE / 2, terrain[x - 1][z] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 10.5); glVertex3d(z - GRID_SIZE / 2, terrain[x + 1][z] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 10.5); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x + 1][z + 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x - 1][z + 1] + 0.1, x - GRID_SIZE / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - terrain.width() / 2, terrain(x - 1, z) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(0, 10.5); glVertex3d(z - terrain.width() / 2, terrain(x + 1, z) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 10.5); glVertex3d(z + 1 - terrain.width() / 2, terrain(x + 1, z + 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z + 1 - terrain.width() / 2, terrain(x - 1, z + 1) + 0.1, x - terrain.height() / 2);
 	glEnd();
 
 	glBindTexture(GL_TEXTURE_2D, 1);
@@ -823,44 +692,44 @@ void buildCrosswalkDown(int x, int z)
 }
 
 // Build roads downwards
-void buildRoadDown(int x, int z)
+void buildRoadDown(const HeightMap& terrain, int x, int z)
 {
 	glBegin(GL_POLYGON);
-	glTexCoord2d(0, 0); glVertex3d(z - GRID_SIZE / 2, terrain[x - 1][z] + 0.1, x - 1 - GRID_SIZE / 2);
-	glTexCoord2d(0, 2); glVertex3d(z - GRID_SIZE / 2, terrain[x + 1][z] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 2); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x + 1][z + 1] + 0.1, x + 1 - GRID_SIZE / 2);
-	glTexCoord2d(1, 0); glVertex3d(z + 1 - GRID_SIZE / 2, terrain[x - 1][z + 1] + 0.1, x - 1 - GRID_SIZE / 2);
+	glTexCoord2d(0, 0); glVertex3d(z - terrain.width() / 2, terrain(x - 1, z) + 0.1, x - 1 - terrain.height() / 2);
+	glTexCoord2d(0, 2); glVertex3d(z - terrain.width() / 2, terrain(x + 1, z) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 2); glVertex3d(z + 1 - terrain.width() / 2, terrain(x + 1, z + 1) + 0.1, x + 1 - terrain.height() / 2);
+	glTexCoord2d(1, 0); glVertex3d(z + 1 - terrain.width() / 2, terrain(x - 1, z + 1) + 0.1, x - 1 - terrain.height() / 2);
 	glEnd();
 }
 
 // Build the city expanding downwards
-void buildCityDown() {
+void buildCityDown(HeightMap& terrain, HeightMap& waterHeight, TerrainClasses& classes) {
 	bool buildingPlaced = true;
 	int x = cityLocation.x;
 	int z = cityLocation.z;
 	int counter = 0;
 	// Loop to place city roads and buildings
-	while (z + 1 < GRID_SIZE && isAboveWater(x, z) && isAboveWater(x - 1, z) && isAboveWater(x + 1, z) && isAboveWater(x, z + 1) && isAboveWater(x - 1, z + 1) && isAboveWater(x + 1, z + 1) && x - 1 >= 0 && x + 1 < GRID_SIZE) {
+	while (z + 1 < terrain.width() && classes.areas().allDry(x - 1, z, 3, 2) && x - 1 >= 0 && x + 1 < terrain.height()) {
 		// Place buildings
-		if (counter % 2 == 0 && checkBuildingSpace(x - 2, z))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x - 2, z))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 1;
 			int numOfFloors = (counter % 4) + 1;
 			glPushMatrix();
-			glTranslated(z - GRID_SIZE / 2, terrain[x - 2][z] + 0.15, x - 2 - GRID_SIZE / 2);
+			glTranslated(z - terrain.width() / 2, terrain(x - 2, z) + 0.15, x - 2 - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
 			glPopMatrix();
 		}
-		if (counter % 2 == 0 && checkBuildingSpace(x + 2, z))
+		if (counter % 2 == 0 && checkBuildingSpace(classes, x + 2, z))
 		{
 			buildingPlaced = false;
 			int numOfWindows = (counter % 4) + 2;
 			int numOfFloors = (counter % 4) + 2;
 			glPushMatrix();
-			glTranslated(z - GRID_SIZE / 2, terrain[x + 2][z] + 0.15, x + 2 - GRID_SIZE / 2);
+			glTranslated(z - terrain.width() / 2, terrain(x + 2, z) + 0.15, x + 2 - terrain.height() / 2);
 			glRotated(45, 0, 1, 0);
 			glScaled(1, numOfFloors / 2 + 1, 1);
 			drawBuilding(numOfFloors, numOfWindows);
@@ -870,17 +739,18 @@ void buildCityDown() {
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, 1);
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-		terrain[x - 2][z] = terrain[x + 2][z] = terrain[x - 1][z] = terrain[x + 1][z] = terrain[x][z];
-		terrain[x - 2][z + 1] = terrain[x + 2][z + 1] = terrain[x - 1][z + 1] = terrain[x + 1][z + 1] = terrain[x][z + 1];
-		waterHeight[x - 2][z] = waterHeight[x + 2][z] = waterHeight[x - 1][z] = waterHeight[x + 1][z] = waterHeight[x][z] = -1;
-		waterHeight[x - 2][z + 1] = waterHeight[x + 2][z + 1] = waterHeight[x - 1][z + 1] = waterHeight[x + 1][z + 1] = waterHeight[x][z + 1] = -1;
+		terrain(x - 2, z) = terrain(x + 2, z) = terrain(x - 1, z) = terrain(x + 1, z) = terrain(x, z);
+		terrain(x - 2, z + 1) = terrain(x + 2, z + 1) = terrain(x - 1, z + 1) = terrain(x + 1, z + 1) = terrain(x, z + 1);
+		waterHeight(x - 2, z) = waterHeight(x + 2, z) = waterHeight(x - 1, z) = waterHeight(x + 1, z) = waterHeight(x, z) = -1;
+		waterHeight(x - 2, z + 1) = waterHeight(x + 2, z + 1) = waterHeight(x - 1, z + 1) = waterHeight(x + 1, z + 1) = waterHeight(x, z + 1) = -1;
+		classes.changed(x - 2, z, 5, 2);
 
 		// Draw crosswalks or roads
 		if (counter % 8 == 0) {//crosswalk
-			buildCrosswalkDown(x, z);
+			buildCrosswalkDown(terrain, x, z);
 		}
 		else {//road
-			buildRoadDown(x, z);
+			buildRoadDown(terrain, x, z);
 		}
 		glDisable(GL_TEXTURE_2D);
 		counter++;
@@ -889,18 +759,18 @@ void buildCityDown() {
 }
 
 // Determine where to build the city based on the city expansion direction
-void buildCity() {
+void buildCity(HeightMap& terrain, HeightMap& waterHeight, TerrainClasses& classes) {
 	if (cityExpandRight) {
-		buildCityRight();
+		buildCityRight(terrain, waterHeight, classes);
 	}
 	else if (cityExpandLeft) {
-		buildCityLeft();
+		buildCityLeft(terrain, waterHeight, classes);
 	}
 	else if (cityExpandUp) {
-		buildCityUp();
+		buildCityUp(terrain, waterHeight, classes);
 	}
 	else if (cityExpandDown) {
-		buildCityDown();
+		buildCityDown(terrain, waterHeight, classes);
 	}
 }
 
@@ -919,26 +789,55 @@ void display()
 	glMatrixMode(GL_MODELVIEW); // Set the matrix mode to model transformations
 	glLoadIdentity(); // Reset the transformation matrix
 
-	DrawTerrain(); // Draw the terrain
+	if (streamingMode)
+	{
+		// The streamed world has no erosion animation or city
+		DrawChunks(*chunkManager);
+		glutSwapBuffers();
+		return;
+	}
 
-	// Apply hydraulic erosion if not stopped
-	if (!stopErosion && cityLocation.x == -100) {
-		for (int i = 0; i < 2; i++)
-		{
-			hydraulicErosion();
+	// Hydraulic erosion runs on its own thread until it is stopped, the world grids are updated when it stops
+	bool eroding = !stopErosion && cityLocation.x == -100;
+	if (eroding && !erosionThread->running()) {
+		erosionThread->start(worldTerrain, worldWater, pipeMode, lakesMode);
+		convergenceReported = false;
+		citySearched = false;
+	}
+	else if (!eroding && erosionThread->running()) {
+		erosionThread->stop(worldTerrain, worldWater);
+		worldClasses.changedAll(); // The eroded copies replaced the world grids
+		if (riversMode)
+			placeRivers(worldTerrain, worldWater); // Rivers only land in cells already reported
+	}
+
+	if (eroding) {
+		if (erosionThread->converged() && !convergenceReported) {
+			const ErosionWindow& window = erosionThread->convergenceWindow();
+			printf("erosion converged after %lld %s: heights %.3f to %.3f, mean change %.2g, %.3f%% of cells redirected\n",
+				erosionThread->convergenceUnits(), pipeMode ? "pipe steps" : "droplets", window.minHeight, window.maxHeight,
+				window.heightChange, window.flowChanges * 100);
+			convergenceReported = true;
 		}
+		const ErosionThread::Snapshot& snapshot = erosionThread->latest();
+		DrawTerrain(snapshot.terrain, snapshot.waterHeight, NULL); // Draw the terrain
 	}
 	else {
-		if (cityLocation.x == -100) {
-			int randomX = rand() % GRID_SIZE;
-			int randomZ = rand() % GRID_SIZE;
-			floodFill(randomX, randomZ); // Find the city location
+		if (!worldClasses.attached())
+			worldClasses.attach(worldTerrain, worldWater, defaultThreadCount());
+		DrawTerrain(worldTerrain, worldWater, &worldClasses); // Draw the terrain
+		if (!citySearched) {
+			citySearched = true;
+			if (cityLocation.x == -100 && rankedMode)
+				searchBestCitySite(worldClasses.masks(), worldClasses.areas(), 1); // Found the city at the best site
+			else if (cityLocation.x == -100)
+				searchCitySite(worldClasses.masks()); // Find the city location
 		}
 	}
 
 	// Build the city if a location is found
 	if (cityLocation.x != -100) {
-		buildCity();
+		buildCity(worldTerrain, worldWater, worldClasses);
 	}
 
 	glutSwapBuffers(); // Display the frame buffer
@@ -958,6 +857,13 @@ void idle()
 	cameraPosition.x += movement_speed * viewDirection.x;
 	cameraPosition.z += movement_speed * viewDirection.z;
 
+	if (streamingMode)
+		chunkManager->update(cameraPosition.x, cameraPosition.z);
+
+	// Once erosion has converged the scene only moves with the camera, so frames are capped to leave the CPU idle
+	if (erosionThread != NULL && erosionThread->converged())
+		this_thread::sleep_for(chrono::milliseconds(IDLE_FRAME_MILLISECONDS));
+
 	glutPostRedisplay(); // Redraw the scene
 }
 
@@ -996,10 +902,72 @@ void mouse(int button, int state, int x, int y)
 		stopErosion = !stopErosion;
 }
 
+// Handle keyboard input for saving the world
+void keyboard(unsigned char key, int x, int y)
+{
+	if (key == 's' && !streamingMode)
+	{
+		// The erosion thread is paused so the saved grids and droplet counter match
+		bool eroding = erosionThread->running();
+		if (eroding) {
+			erosionThread->stop(worldTerrain, worldWater);
+			worldClasses.changedAll();
+		}
+		if (saveWorld(savePath, worldTerrain, worldWater))
+			printf("world saved to %s with seed %llu\n", savePath, (unsigned long long)worldSeed);
+		else
+			printf("cannot save the world to %s\n", savePath);
+		if (eroding)
+			erosionThread->start(worldTerrain, worldWater, pipeMode, lakesMode);
+	}
+}
+
 // Main function to initialize GLUT and start the program
 int main(int argc, char* argv[])
 {
 	glutInit(&argc, argv);
+
+	// Flags can appear anywhere on the command line: -stream switches to the endless chunked world, -pyramid generates
+	// grids larger than the default size coarse to fine, -pipe erodes with the pipe model instead of droplets, -rivers
+	// places rivers along the accumulated flow once erosion stops, -lakes keeps the depressions filled with lakes,
+	// -rank-sites founds the city at the best scored site, -load FILE starts from a saved world, -save FILE sets where
+	// the s key saves it and -cache DIR keeps the output of every generation stage for later runs
+	vector<char*> arguments;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-stream") == 0)
+			streamingMode = true;
+		else if (strcmp(argv[i], "-pyramid") == 0)
+			pyramidMode = true;
+		else if (strcmp(argv[i], "-pipe") == 0)
+			pipeMode = true;
+		else if (strcmp(argv[i], "-rivers") == 0)
+			riversMode = true;
+		else if (strcmp(argv[i], "-lakes") == 0)
+			lakesMode = true;
+		else if (strcmp(argv[i], "-rank-sites") == 0)
+			rankedMode = true;
+		else if (strcmp(argv[i], "-load") == 0 && i + 1 < argc)
+			loadPath = argv[++i];
+		else if (strcmp(argv[i], "-save") == 0 && i + 1 < argc)
+			savePath = argv[++i];
+		else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+			cachePath = argv[++i];
+		else
+			arguments.push_back(argv[i]);
+	}
+
+	// An optional world seed on the command line reproduces a previous run
+	if (arguments.size() > 0)
+		worldSeed = strtoull(arguments[0], NULL, 10);
+	else
+		worldSeed = (uint64_t)time(0);
+
+	// An optional second argument sets the grid size
+	if (arguments.size() > 1)
+		gridSize = atoi(arguments[1]);
+	if (gridSize < 8)
+		gridSize = DEFAULT_GRID_SIZE;
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH); // Set display mode
 	glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
 	glutInitWindowPosition(400, 100);
@@ -1010,6 +978,7 @@ int main(int argc, char* argv[])
 
 	glutSpecialFunc(SpecialKeys); // Register special keys callback function
 	glutMouseFunc(mouse); // Register mouse callback function
+	glutKeyboardFunc(keyboard); // Register keyboard callback function
 
 	initializeScene(); // Initialize the scene
 
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "World.h"
+#include "WorldFile.h"
+#include "StageCache.h"
+#include "SinkIndex.h"
+#include "TerrainClasses.h"
+#include "ErosionMonitor.h"
+
+using namespace std;
+
+// Headless generation of a fixed-size world: runs the same stages as the viewer without a window or OpenGL,
+// writes the height maps as raw float32 files or a world file and prints how long every stage took.
+
+// Command line parameters of a run
+typedef struct {
+	uint64_t seed;
+	int size;
+	int faults;
+	int walkers;
+	int steps;
+	int smoothPasses;
+	int detailWalkers;
+	long long droplets;
+	long long erodeTo; // Erode until this many droplets of the erosion stream have run in total, replaces droplets when positive
+	int pipeSteps; // Erode with this many pipe model steps instead of droplets when positive
+	bool pyramid;
+	bool rivers; // Place rivers from the flow accumulation after erosion
+	bool lakes; // Fill the depressions left by erosion with lakes
+	int rankSites; // Found the city at the best scored site and print this many of the best when positive
+	string output; // Prefix of the written files, nothing is written when empty
+	string load; // World file to start from instead of generating the terrain
+	string save; // World file to write at the end
+	string cache; // Directory of the stage cache, stages are always computed when empty
+} CliOptions;
+
+// Timing of one stage
+typedef struct {
+	const char* name;
+	double milliseconds;
+	long long items; // Faults, walker steps, droplets... processed by the stage
+	bool cached; // Skipped because its output was found in the stage cache
+} StageTiming;
+
+typedef chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start)
+{
+	return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+static void printUsage(const char* program)
+{
+	printf("usage: %s [options]\n", program);
+	printf("  -seed N             world seed (default: current time)\n");
+	printf("  -size N             grid size (default %d)\n", DEFAULT_GRID_SIZE);
+	printf("  -faults N           fault lines (default 4000)\n");
+	printf("  -walkers N          random walks (default 500)\n");
+	printf("  -steps N            steps per random walk (default 800)\n");
+	printf("  -smooth N           smoothing passes (default 1)\n");
+	printf("  -detail-walkers N   random walks after smoothing (default 15)\n");
+	printf("  -droplets N         erosion droplets (default 20000)\n");
+	printf("  -erode-to N         erode until droplets 0 to N - 1 have run, also after -load\n");
+	printf("  -pipe N             erode with N steps of the pipe model instead of droplets\n");
+	printf("  -pyramid            form the terrain at the default size and refine it to -size\n");
+	printf("  -rivers             place rivers along the accumulated flow after erosion\n");
+	printf("  -lakes              fill the depressions left by erosion with lakes\n");
+	printf("  -rank-sites N       found the city at the best scored site and print the N best\n");
+	printf("  -out PREFIX         write PREFIX.terrain.raw and PREFIX.water.raw (float32, row by row)\n");
+	printf("  -load FILE          start from a saved world instead of generating the terrain\n");
+	printf("  -save FILE          save the final world\n");
+	printf("  -cache DIR          reuse the output of unchanged stages from earlier runs, stored in DIR\n");
+}
+
+// Returns false on an unknown option or a missing value
+static bool parseOptions(int argc, char* argv[], CliOptions* options)
+{
+	options->seed = (uint64_t)time(0);
+	options->size = DEFAULT_GRID_SIZE;
+	options->faults = 4000;
+	options->walkers = 500;
+	options->steps = 800;
+	options->smoothPasses = 1;
+	options->detailWalkers = 15;
+	options->droplets = 20000;
+	options->erodeTo = 0;
+	options->pipeSteps = 0;
+	options->pyramid = false;
+	options->rivers = false;
+	options->lakes = false;
+	options->rankSites = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* name = argv[i];
+		if (strcmp(name, "-pyramid") == 0)
+		{
+			options->pyramid = true;
+			continue;
+		}
+		if (strcmp(name, "-rivers") == 0)
+		{
+			options->rivers = true;
+			continue;
+		}
+		if (strcmp(name, "-lakes") == 0)
+		{
+			options->lakes = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+		const char* value = argv[++i];
+
+		if (strcmp(name, "-seed") == 0)
+			options->seed = strtoull(value, NULL, 10);
+		else if (strcmp(name, "-size") == 0)
+			options->size = atoi(value);
+		else if (strcmp(name, "-faults") == 0)
+			options->faults = atoi(value);
+		else if (strcmp(name, "-walkers") == 0)
+			options->walkers = atoi(value);
+		else if (strcmp(name, "-steps") == 0)
+			options->steps = atoi(value);
+		else if (strcmp(name, "-smooth") == 0)
+			options->smoothPasses = atoi(value);
+		else if (strcmp(name, "-detail-walkers") == 0)
+			options->detailWalkers = atoi(value);
+		else if (strcmp(name, "-droplets") == 0)
+			options->droplets = atoll(value);
+		else if (strcmp(name, "-erode-to") == 0)
+			options->erodeTo = atoll(value);
+		else if (strcmp(name, "-pipe") == 0)
+			options->pipeSteps = atoi(value);
+		else if (strcmp(name, "-rank-sites") == 0)
+			options->rankSites = atoi(value);
+		else if (strcmp(name, "-out") == 0)
+			options->output = value;
+		else if (strcmp(name, "-load") == 0)
+			options->load = value;
+		else if (strcmp(name, "-save") == 0)
+			options->save = value;
+		else if (strcmp(name, "-cache") == 0)
+			options->cache = value;
+		else
+			return false;
+	}
+	return options->size >= 8;
+}
+
+// Write a height map as raw native-endian float32 values, row by row without padding
+static bool writeRaw(const string& path, const HeightMap& heights)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	vector<float> row(heights.width());
+	bool ok = true;
+	for (int i = 0; i < heights.height() && ok; i++)
+	{
+		for (int j = 0; j < heights.width(); j++)
+			row[j] = (float)heights(i, j);
+		ok = fwrite(&row[0], sizeof(float), row.size(), file) == row.size();
+	}
+	return fclose(file) == 0 && ok;
+}
+
+// Erode with units droplets, or pipe steps with pipeModel, window by window so the erosion monitor measures the run
+// like it measures the viewer's erosion thread. The terrain comes out the same as from a single call.
+static ErosionStats erodeWatched(HeightMap& terrain, HeightMap& water, long long units, PipeErosion<HeightValue>* pipeModel, ErosionMonitor& monitor)
+{
+	ErosionStats stats = { 0, 0, 0 };
+	DropletErosion<HeightValue> droplets;
+	monitor.reset(terrain, pipeModel != NULL);
+	for (long long done = 0; done < units;)
+	{
+		int batch = (int)min(units - done, monitor.unitsToWindowEnd()); // A window holds one droplet per cell at most
+		if (pipeModel != NULL)
+			pipeErosion(terrain, water, batch, pipeModel);
+		else
+		{
+			ErosionStats batchStats = hydraulicErosion(terrain, batch, &droplets);
+			stats.droplets += batchStats.droplets;
+			stats.steps += batchStats.steps;
+			stats.seconds += batchStats.seconds;
+		}
+		monitor.record(terrain, water, batch);
+		done += batch;
+	}
+	if (pipeModel == NULL)
+		droplets.finishRound(terrain, defaultThreadCount());
+	return stats;
+}
+
+int main(int argc, char* argv[])
+{
+	CliOptions options;
+	if (!parseOptions(argc, argv, &options))
+	{
+		printUsage(argv[0]);
+		return 2;
+	}
+	worldSeed = options.seed;
+
+	MappedFile mapping;
+	HeightMap terrain, water;
+	StageCache cache(options.cache, options.seed, options.size, options.size, terrain, water);
+	vector<StageTiming> timings;
+	ErosionStats erosionStats = { 0, 0, 0 };
+	PipeErosion<HeightValue> pipeModel(defaultPipeSettings()); // Seeded from the water of the terrain it first erodes
+	ErosionMonitor monitor(defaultConvergenceSettings());
+	Clock::time_point total = Clock::now();
+	Clock::time_point start;
+
+	if (!options.load.empty())
+	{
+		start = Clock::now();
+		if (!loadWorld(options.load.c_str(), mapping, terrain, water))
+		{
+			fprintf(stderr, "cannot load a world from %s\n", options.load.c_str());
+			return 1;
+		}
+		options.seed = worldSeed;
+		StageTiming load = { "load", millisecondsSince(start), (long long)terrain.height() * terrain.width(), false };
+		timings.push_back(load);
+
+		// Fast-forward: the saved world already ran dropletCount droplets of its stream
+		if (options.erodeTo > 0)
+			options.droplets = max(0LL, options.erodeTo - (long long)dropletCount);
+
+		start = Clock::now();
+		StageTiming erosion = { "erosion", 0, options.droplets, false };
+		if (options.pipeSteps > 0)
+		{
+			erodeWatched(terrain, water, options.pipeSteps, &pipeModel, monitor);
+			erosion.name = "pipe erosion";
+			erosion.items = options.pipeSteps;
+		}
+		else
+			erosionStats = erodeWatched(terrain, water, options.droplets, NULL, monitor);
+		erosion.milliseconds = millisecondsSince(start);
+		timings.push_back(erosion);
+
+		if (options.rivers)
+		{
+			start = Clock::now();
+			StageTiming rivers = { "rivers", 0, placeRivers(terrain, water), false };
+			rivers.milliseconds = millisecondsSince(start);
+			timings.push_back(rivers);
+		}
+
+		if (options.lakes)
+		{
+			start = Clock::now();
+			StageTiming lakes = { "lakes", 0, fillLakes(terrain, water), false };
+			lakes.milliseconds = millisecondsSince(start);
+			timings.push_back(lakes);
+		}
+	}
+	else
+	{
+		// Every stage goes through the cache, which only computes the stages after the first change
+		terrain.resize(options.size, options.size);
+		if (options.erodeTo > 0)
+			options.droplets = options.erodeTo;
+		const CliOptions& o = options;
+
+		vector<StageTiming> stages;
+		if (o.pyramid && o.size > DEFAULT_GRID_SIZE)
+		{
+			StageTiming pyramid = { "pyramid", 0, (long long)o.size * o.size, false };
+			start = Clock::now();
+			pyramid.cached = !cache.run("pyramid", { (double)o.size }, [&](HeightMap& t, HeightMap& w) { generateTerrainPyramid(t, o.size); });
+			pyramid.milliseconds = millisecondsSince(start);
+			stages.push_back(pyramid);
+		}
+		else
+		{
+			StageTiming faults = { "faults", 0, o.faults, false };
+			start = Clock::now();
+			faults.cached = !cache.run("faults", { (double)o.faults }, [&](HeightMap& t, HeightMap& w) { UpdateTerrainMethod2(t, o.faults); });
+			faults.milliseconds = millisecondsSince(start);
+			stages.push_back(faults);
+
+			StageTiming walks = { "random walk", 0, (long long)o.walkers * o.steps, false };
+			start = Clock::now();
+			walks.cached = !cache.run("random walk", { (double)o.walkers, (double)o.steps }, [&](HeightMap& t, HeightMap& w) { UpdateTerrainMethod3(t, o.walkers, o.steps); });
+			walks.milliseconds = millisecondsSince(start);
+			stages.push_back(walks);
+
+			StageTiming smooth = { "smooth", 0, o.smoothPasses, false };
+			start = Clock::now();
+			smooth.cached = !cache.run("smooth", { (double)o.smoothPasses }, [&](HeightMap& t, HeightMap& w) { SmoothTerrain(t, o.smoothPasses); });
+			smooth.milliseconds = millisecondsSince(start);
+			stages.push_back(smooth);
+
+			StageTiming detail = { "detail walk", 0, (long long)o.detailWalkers * o.steps, false };
+			start = Clock::now();
+			detail.cached = !cache.run("detail walk", { (double)o.detailWalkers, (double)o.steps }, [&](HeightMap& t, HeightMap& w) { UpdateTerrainMethod3(t, o.detailWalkers, o.steps); });
+			detail.milliseconds = millisecondsSince(start);
+			stages.push_back(detail);
+		}
+
+		StageTiming waterInit = { "water init", 0, (long long)o.size * o.size, false };
+		start = Clock::now();
+		waterInit.cached = !cache.run("water init", {}, [&](HeightMap& t, HeightMap& w) { initializeWaterHeight(t, w); });
+		waterInit.milliseconds = millisecondsSince(start);
+		stages.push_back(waterInit);
+
+		StageTiming erosion = { "erosion", 0, o.droplets, false };
+		start = Clock::now();
+		if (o.pipeSteps > 0)
+		{
+			erosion.name = "pipe erosion";
+			erosion.items = o.pipeSteps;
+			erosion.cached = !cache.run("pipe erosion", { (double)o.pipeSteps }, [&](HeightMap& t, HeightMap& w) { erodeWatched(t, w, o.pipeSteps, &pipeModel, monitor); });
+		}
+		else
+			erosion.cached = !cache.run("erosion", { (double)o.droplets }, [&](HeightMap& t, HeightMap& w) { erosionStats = erodeWatched(t, w, o.droplets, NULL, monitor); });
+		erosion.milliseconds = millisecondsSince(start);
+		stages.push_back(erosion);
+
+		if (o.rivers)
+		{
+			StageTiming rivers = { "rivers", 0, 0, false };
+			start = Clock::now();
+			rivers.cached = !cache.run("rivers", {}, [&](HeightMap& t, HeightMap& w) { rivers.items = placeRivers(t, w); });
+			rivers.milliseconds = millisecondsSince(start);
+			stages.push_back(rivers);
+		}
+
+		if (o.lakes)
+		{
+			StageTiming lakes = { "lakes", 0, 0, false };
+			start = Clock::now();
+			lakes.cached = !cache.run("lakes", {}, [&](HeightMap& t, HeightMap& w) { lakes.items = fillLakes(t, w); });
+			lakes.milliseconds = millisecondsSince(start);
+			stages.push_back(lakes);
+		}
+
+		// Loading the last cached stage is counted as its own step
+		start = Clock::now();
+		cache.finish();
+		StageTiming load = { "cache load", millisecondsSince(start), cache.hits(), false };
+		timings.insert(timings.end(), stages.begin(), stages.end());
+		if (stages.back().cached)
+			timings.push_back(load);
+	}
+
+	start = Clock::now();
+	int sites = 0;
+	vector<RankedSite> ranking;
+	if (cityLocation.x == -100)
+	{
+		TerrainClasses classes;
+		classes.attach(terrain, water, defaultThreadCount());
+		if (options.rankSites > 0)
+		{
+			ranking = searchBestCitySite(classes.masks(), classes.areas(), options.rankSites);
+			sites = (int)ranking.size();
+		}
+		else
+			sites = searchCitySite(classes.masks());
+	}
+	StageTiming city = { "city search", millisecondsSince(start), sites, false };
+	timings.push_back(city);
+
+	// Drainage basins of the final terrain, every cell is looked up in the sink index
+	start = Clock::now();
+	FlowDirections<HeightValue> directions;
+	directions.build(terrain, defaultThreadCount());
+	SinkIndex<HeightValue> sinks;
+	sinks.attach(directions);
+	BasinStats basins = drainageBasins(sinks, directions);
+	StageTiming drainage = { "basins", millisecondsSince(start), (long long)terrain.height() * terrain.width(), false };
+	timings.push_back(drainage);
+
+	if (!options.save.empty())
+	{
+		start = Clock::now();
+		if (!saveWorld(options.save.c_str(), terrain, water))
+		{
+			fprintf(stderr, "cannot save the world to %s\n", options.save.c_str());
+			return 1;
+		}
+		StageTiming save = { "save", millisecondsSince(start), (long long)terrain.height() * terrain.width(), false };
+		timings.push_back(save);
+	}
+
+	double totalMilliseconds = millisecondsSince(total);
+
+	printf("seed %llu, grid %d x %d\n", (unsigned long long)options.seed, terrain.height(), terrain.width());
+	printf("%-12s %12s %14s\n", "stage", "ms", "items");
+	for (size_t i = 0; i < timings.size(); i++)
+		printf("%-12s %12.2f %14lld%s\n", timings[i].name, timings[i].milliseconds, timings[i].items, timings[i].cached ? "  cached" : "");
+	printf("%-12s %12.2f\n", "total", totalMilliseconds);
+	if (erosionStats.seconds > 0)
+		printf("erosion: %lld droplets, %lld steps, %.0f droplets/s, %.0f steps/s\n", erosionStats.droplets, erosionStats.steps,
+			erosionStats.droplets / erosionStats.seconds, erosionStats.steps / erosionStats.seconds);
+	const ErosionWindow& window = monitor.lastWindow();
+	if (window.units > 0)
+	{
+		const char* unit = options.pipeSteps > 0 ? "pipe steps" : "droplets";
+		printf("erosion window at %lld %s: heights %.3f to %.3f, mean change %.2g, %.3f%% of cells redirected\n", window.units,
+			unit, window.minHeight, window.maxHeight, window.heightChange, window.flowChanges * 100);
+		if (monitor.converged())
+			printf("erosion converged after %lld %s\n", monitor.convergenceUnits(), unit);
+	}
+	if (basins.basins > 0)
+		printf("drainage: %d basins, the largest drains %d cells to row %d, column %d\n", basins.basins, basins.largest,
+			basins.largestSink / terrain.width(), basins.largestSink % terrain.width());
+
+	for (size_t i = 0; i < ranking.size(); i++)
+		printf("site %d: row %d, column %d, score %d (dry %d, river %d, sea %d)\n", (int)i + 1, ranking[i].site.x,
+			ranking[i].site.z, ranking[i].score, ranking[i].dryArea, ranking[i].riverLength, ranking[i].seaDistance);
+	if (cityLocation.x != -100)
+		printf("city site at row %d, column %d\n", cityLocation.x, cityLocation.z);
+	else
+		printf("no city site found\n");
+
+	if (!options.output.empty())
+	{
+		if (!writeRaw(options.output + ".terrain.raw", terrain) || !writeRaw(options.output + ".water.raw", water))
+		{
+			fprintf(stderr, "cannot write %s.*.raw\n", options.output.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}